@@ -0,0 +1,206 @@
+#include "corpus.hpp"
+#include <acul/string/sstream.hpp>
+
+namespace ahtt::bench
+{
+    static const char *lorem[] = {
+        "Lorem ipsum dolor sit amet, consectetur adipiscing elit, sed do eiusmod tempor incididunt.",
+        "Ut enim ad minim veniam, quis nostrud exercitation ullamco laboris nisi ut aliquip.",
+        "Duis aute irure dolor in reprehenderit in voluptate velit esse cillum dolore eu fugiat.",
+        "Excepteur sint occaecat cupidatat non proident, sunt in culpa qui officia deserunt mollit."};
+
+    static void indent(acul::stringstream &ss, size_t level)
+    {
+        for (size_t i = 0; i < level; ++i) ss << "  ";
+    }
+
+    static void put(MemoryFileProvider &files, const acul::path &path, const acul::stringstream &ss)
+    {
+        files.set(path, ss.str());
+    }
+
+    static void deep_nesting(MemoryFileProvider &files, const acul::path &dir, size_t scale)
+    {
+        const size_t depth = 48;
+        acul::stringstream ss;
+        for (size_t r = 0; r < 10 * scale; ++r)
+        {
+            for (size_t d = 0; d < depth; ++d)
+            {
+                indent(ss, d);
+                ss << "div.level-" << d << '\n';
+            }
+            indent(ss, depth);
+            ss << "span.leaf Leaf " << r << " #{value}\n";
+        }
+        put(files, dir / "page.at", ss);
+    }
+
+    static void wide_siblings(MemoryFileProvider &files, const acul::path &dir, size_t scale)
+    {
+        acul::stringstream ss;
+        ss << "ul.list\n";
+        for (size_t i = 0; i < 2000 * scale; ++i) ss << "  li.item(data-index=\"" << i << "\") Item " << i << '\n';
+        put(files, dir / "page.at", ss);
+    }
+
+    static void attr_interp(MemoryFileProvider &files, const acul::path &dir, size_t scale)
+    {
+        acul::stringstream ss;
+        ss << "div.links\n";
+        for (size_t i = 0; i < 400 * scale; ++i)
+            ss << "  a.link-#{cls}.n" << i << "#item-" << i << "(href=\"/items/#{id}?page=" << i
+               << "\", title=_(\"Item #{name}\"), data-a=\"#{a}-" << i << "\", data-b=b, disabled) Link #{name} "
+               << i << '\n';
+        put(files, dir / "page.at", ss);
+    }
+
+    static void text_blocks(MemoryFileProvider &files, const acul::path &dir, size_t scale)
+    {
+        acul::stringstream ss;
+        for (size_t b = 0; b < 40 * scale; ++b)
+        {
+            ss << "div.section\n  p.\n";
+            for (size_t l = 0; l < 30; ++l)
+            {
+                ss << "    " << lorem[l % 4];
+                if (l % 7 == 0) ss << " #{value} and _(\"translated\")";
+                ss << '\n';
+            }
+        }
+        put(files, dir / "page.at", ss);
+    }
+
+    static void mixins(MemoryFileProvider &files, const acul::path &dir, size_t scale)
+    {
+        const size_t count = 60 * scale;
+        acul::stringstream ss;
+        for (size_t m = 0; m < count; ++m)
+        {
+            ss << "mixin card_" << m << "(int n, const char *title)\n"
+               << "  div.card(data-n=n)\n"
+               << "    h3.title= title\n"
+               << "    div.body\n"
+               << "      block\n";
+        }
+        for (size_t m = 0; m < count; ++m)
+        {
+            ss << "+card_" << m << "(" << m << ", \"Card " << m << "\")\n"
+               << "  p Content of card " << m << " #{value}\n";
+        }
+        put(files, dir / "page.at", ss);
+    }
+
+    static void include_fanout(MemoryFileProvider &files, const acul::path &dir, size_t scale)
+    {
+        const size_t fanout = 8;
+        for (size_t j = 0; j < fanout; ++j)
+        {
+            acul::stringstream ss;
+            ss << "div.leaf-" << j << "\n  p " << lorem[j % 4] << "\n  span #{value}\n";
+            put(files, dir / acul::format("parts/leaf_%zu.at", j), ss);
+        }
+        for (size_t i = 0; i < fanout * scale; ++i)
+        {
+            acul::stringstream ss;
+            ss << "section.group-" << i << '\n';
+            for (size_t j = 0; j < fanout; ++j) ss << "  div.slot\n    include parts/leaf_" << j << ".at\n";
+            put(files, dir / acul::format("parts/group_%zu.at", i), ss);
+        }
+        acul::stringstream ss;
+        ss << "div.page\n";
+        for (size_t i = 0; i < fanout * scale; ++i) ss << "  div.group\n    include parts/group_" << i << ".at\n";
+        put(files, dir / "page.at", ss);
+    }
+
+    static void layout_blocks(MemoryFileProvider &files, const acul::path &dir, size_t scale)
+    {
+        const size_t blocks = 30 * scale;
+        acul::stringstream ss;
+        ss << "doctype html\nhtml\n  head\n    title Benchmark\n  body\n";
+        for (size_t b = 0; b < blocks; ++b)
+            ss << "    div.region-" << b << "\n      block region_" << b << "\n        p Default " << b << '\n';
+        put(files, dir / "layout.at", ss);
+
+        acul::stringstream page;
+        page << "extends layout.at\n";
+        for (size_t b = 0; b < blocks; ++b)
+        {
+            static const char *modes[] = {"block", "append", "prepend"};
+            if (b % 4 == 3) continue; // keep some defaults
+            page << modes[b % 3] << " region_" << b << "\n  p " << lorem[b % 4] << " #{value}\n";
+        }
+        put(files, dir / "page.at", page);
+    }
+
+    // A page at the bottom of a chain of layouts, each one filling some blocks of its parent and opening new ones.
+    static void layout_chain(MemoryFileProvider &files, const acul::path &dir, size_t scale)
+    {
+        const size_t depth = 8;
+        const size_t blocks = 10 * scale;
+        acul::stringstream ss;
+        ss << "doctype html\nhtml\n  head\n    title Benchmark\n  body\n";
+        for (size_t b = 0; b < blocks; ++b)
+            ss << "    div.region-" << b << "\n      block region_0_" << b << "\n        p Default " << b << '\n';
+        put(files, dir / "layout_0.at", ss);
+
+        for (size_t level = 1; level < depth; ++level)
+        {
+            acul::stringstream layout;
+            layout << "extends layout_" << level - 1 << ".at\n";
+            for (size_t b = 0; b < blocks; ++b)
+                layout << (b % 2 ? "append" : "block") << " region_" << level - 1 << '_' << b << "\n  div.level-"
+                       << level << "\n    block region_" << level << '_' << b << "\n      p " << lorem[b % 4] << '\n';
+            put(files, dir / acul::format("layout_%zu.at", level), layout);
+        }
+
+        acul::stringstream page;
+        page << "extends layout_" << depth - 1 << ".at\n";
+        for (size_t b = 0; b < blocks; b += 2)
+            page << "block region_" << depth - 1 << '_' << b << "\n  p " << lorem[b % 4] << " #{value}\n";
+        put(files, dir / "page.at", page);
+    }
+
+    // Hundreds of includes and blocks as siblings under one parent, where every splice shifts the same list.
+    static void sibling_splices(MemoryFileProvider &files, const acul::path &dir, size_t scale)
+    {
+        const size_t slots = 200 * scale;
+        acul::stringstream ss;
+        ss << "html\n  body\n    ul\n";
+        for (size_t i = 0; i < slots; ++i)
+        {
+            files.set(dir / acul::format("parts/item_%zu.at", i), acul::format("li.item-%zu\n  span #{value}\n", i));
+            ss << "      include parts/item_" << i << ".at\n";
+        }
+        for (size_t b = 0; b < slots; ++b) ss << "    block slot_" << b << "\n      p Default " << b << '\n';
+        put(files, dir / "layout.at", ss);
+
+        acul::stringstream page;
+        page << "extends layout.at\n";
+        for (size_t b = 0; b < slots; b += 2) page << "block slot_" << b << "\n  p " << lorem[b % 4] << '\n';
+        put(files, dir / "page.at", page);
+    }
+
+    acul::vector<Case> generate_corpus(MemoryFileProvider &files, const acul::path &root, size_t scale)
+    {
+        using Generator = void (*)(MemoryFileProvider &, const acul::path &, size_t);
+        static const struct
+        {
+            const char *name;
+            Generator generate;
+        } generators[] = {{"deep_nesting", deep_nesting},   {"wide_siblings", wide_siblings},
+                          {"attr_interp", attr_interp},     {"text_blocks", text_blocks},
+                          {"mixins", mixins},               {"include_fanout", include_fanout},
+                          {"layout_blocks", layout_blocks}, {"layout_chain", layout_chain},
+                          {"sibling_splices", sibling_splices}};
+
+        acul::vector<Case> cases;
+        for (const auto &g : generators)
+        {
+            acul::path dir = root / g.name;
+            g.generate(files, dir, scale);
+            cases.push_back({g.name, dir});
+        }
+        return cases;
+    }
+} // namespace ahtt::bench
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <files.hpp>
+
+namespace ahtt::bench
+{
+    struct Case
+    {
+        acul::string name;
+        acul::path input;
+    };
+
+    // Writes a synthetic template corpus into `files` under `root`. Every case stresses one shape of
+    // template; `scale` multiplies the size of all of them.
+    acul::vector<Case> generate_corpus(MemoryFileProvider &files, const acul::path &root, size_t scale);
+} // namespace ahtt::bench
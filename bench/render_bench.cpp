@@ -0,0 +1,287 @@
+#include <acul/io/fs/file.hpp>
+#include <acul/string/sstream.hpp>
+#include <args.hxx>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <string>
+#include <version.h>
+
+// Generated at build time from bench/templates
+#include <card.hpp>
+#include <listing.hpp>
+#include <report.hpp>
+
+// Every allocation made by render() is counted by wrapping the libc allocator, so containers with
+// their own allocators are included. Elsewhere the allocation columns stay empty.
+#if defined(__GLIBC__)
+    #define AHTT_BENCH_TRACK_ALLOC 1
+
+extern "C"
+{
+    void *__libc_malloc(size_t size);
+    void *__libc_calloc(size_t count, size_t size);
+    void *__libc_realloc(void *ptr, size_t size);
+    void __libc_free(void *ptr);
+}
+
+static thread_local bool g_tracking = false;
+static thread_local size_t g_allocs = 0;
+static thread_local size_t g_peak = 0;
+
+static inline void track(size_t size)
+{
+    if (!g_tracking) return;
+    ++g_allocs;
+    g_peak = std::max(g_peak, size);
+}
+
+extern "C"
+{
+    void *malloc(size_t size)
+    {
+        track(size);
+        return __libc_malloc(size);
+    }
+
+    void *calloc(size_t count, size_t size)
+    {
+        track(count * size);
+        return __libc_calloc(count, size);
+    }
+
+    void *realloc(void *ptr, size_t size)
+    {
+        track(size);
+        return __libc_realloc(ptr, size);
+    }
+
+    void free(void *ptr) { __libc_free(ptr); }
+}
+#else
+    #define AHTT_BENCH_TRACK_ALLOC 0
+#endif
+
+namespace bench
+{
+    struct Size
+    {
+        const char *name;
+        size_t items;
+    };
+
+    static const Size sizes[] = {{"small", 4}, {"medium", 64}, {"large", 1024}};
+
+    struct Result
+    {
+        const char *name;
+        const char *size;
+        size_t output_bytes = 0;
+        double renders_per_s = 0;
+        double ns_per_byte = 0;
+        size_t allocs = 0;
+        size_t peak_bytes = 0;
+    };
+
+    static acul::vector<acul::string> make_tags(size_t count)
+    {
+        static const char *words[] = {"new", "sale", "eco", "limited", "bundle", "gift", "premium", "classic"};
+        acul::vector<acul::string> tags;
+        tags.reserve(count);
+        for (size_t i = 0; i < count; ++i) tags.push_back(acul::format("%s-%zu", words[i % 8], i));
+        return tags;
+    }
+
+    static ahtt::bench::Product make_product(size_t id, size_t tags)
+    {
+        return {static_cast<int>(id),
+                acul::format("product-%zu", id),
+                acul::format("Product <%zu> & \"friends\"", id),
+                static_cast<int>(10 + id % 990),
+                id % 5 != 0,
+                make_tags(tags)};
+    }
+
+    static ahtt::bench::Report make_report(size_t rows)
+    {
+        ahtt::bench::Report report;
+        report.title = "Quarterly balances";
+        report.columns = {"Q1", "Q2", "Q3", "Q4"};
+        report.rows.reserve(rows);
+        for (size_t i = 0; i < rows; ++i)
+        {
+            ahtt::bench::Row row{static_cast<int>(i), acul::format("Owner %zu", i), {}};
+            for (size_t q = 0; q < 4; ++q) row.values.push_back(static_cast<double>((i * 37 + q * 11) % 2000) - 500.0);
+            report.rows.push_back(std::move(row));
+        }
+        return report;
+    }
+
+    template <class Render>
+    static Result measure(const char *name, const Size &size, double min_seconds, Render &&render)
+    {
+        using clock = std::chrono::steady_clock;
+        Result r{name, size.name};
+
+        // Pooled and reused buffers grow on the first render; the allocation columns show the ones after it.
+        render();
+#if AHTT_BENCH_TRACK_ALLOC
+        g_allocs = g_peak = 0;
+        g_tracking = true;
+#endif
+        r.output_bytes = render().size();
+#if AHTT_BENCH_TRACK_ALLOC
+        g_tracking = false;
+        r.allocs = g_allocs;
+        r.peak_bytes = g_peak;
+#endif
+
+        size_t renders = 0, sink = 0;
+        auto start = clock::now();
+        double elapsed = 0;
+        do {
+            for (int i = 0; i < 16; ++i) sink += render().size();
+            renders += 16;
+            elapsed = std::chrono::duration<double>(clock::now() - start).count();
+        } while (elapsed < min_seconds);
+
+        if (sink != renders * r.output_bytes) throw acul::runtime_error("render() output is not deterministic");
+        r.renders_per_s = renders / elapsed;
+        r.ns_per_byte = elapsed * 1e9 / (static_cast<double>(renders) * r.output_bytes);
+        return r;
+    }
+
+    // render_to() appends to a buffer reused between renders, as a server would with its response buffer.
+    template <class Buffer, class RenderTo>
+    static Result measure_to(const char *name, const Size &size, double min_seconds, RenderTo &&render_to)
+    {
+        Buffer buffer;
+        return measure(name, size, min_seconds, [&]() -> const Buffer & {
+            buffer.clear();
+            render_to(buffer);
+            return buffer;
+        });
+    }
+
+    // Content-Length is taken from measure(), so it must match what render() writes, formatting state included.
+    static void check_measure(const char *name, const Size &size, size_t measured, size_t rendered)
+    {
+        if (measured != rendered)
+            throw acul::runtime_error(acul::format("%s (%s): measure() returned %zu bytes, render() wrote %zu", name,
+                                                   size.name, measured, rendered));
+    }
+
+    static acul::vector<Result> run(double min_seconds)
+    {
+        acul::vector<Result> results;
+        for (const auto &size : sizes)
+        {
+            auto product = make_product(1, size.items);
+            check_measure("card", size, ahtt::card::measure(product), ahtt::card::render(product).size());
+            results.push_back(measure("card", size, min_seconds, [&] { return ahtt::card::render(product); }));
+            auto card_to = [&](auto &out) { ahtt::card::render_to(out, product); };
+            results.push_back(measure_to<std::string>("card_to", size, min_seconds, card_to));
+            results.push_back(measure_to<ahtt::SegmentList>("card_iov", size, min_seconds, card_to));
+        }
+        for (const auto &size : sizes)
+        {
+            acul::vector<ahtt::bench::Product> products;
+            for (size_t i = 0; i < size.items; ++i) products.push_back(make_product(i, 3));
+            acul::string title = "Catalog";
+            check_measure("listing", size, ahtt::listing::measure(title, products),
+                          ahtt::listing::render(title, products).size());
+            results.push_back(
+                measure("listing", size, min_seconds, [&] { return ahtt::listing::render(title, products); }));
+            auto listing_to = [&](auto &out) { ahtt::listing::render_to(out, title, products); };
+            results.push_back(measure_to<std::string>("listing_to", size, min_seconds, listing_to));
+            results.push_back(measure_to<ahtt::SegmentList>("listing_iov", size, min_seconds, listing_to));
+        }
+        for (const auto &size : sizes)
+        {
+            auto report = make_report(size.items);
+            check_measure("report", size, ahtt::report::measure(report), ahtt::report::render(report).size());
+            results.push_back(measure("report", size, min_seconds, [&] { return ahtt::report::render(report); }));
+            auto report_to = [&](auto &out) { ahtt::report::render_to(out, report); };
+            results.push_back(measure_to<std::string>("report_to", size, min_seconds, report_to));
+            results.push_back(measure_to<ahtt::SegmentList>("report_iov", size, min_seconds, report_to));
+        }
+        return results;
+    }
+
+    static void print_results(const acul::vector<Result> &results)
+    {
+        printf("%-10s %-8s %12s %12s %10s %10s %12s\n", "template", "input", "bytes", "renders/s", "ns/byte",
+               "allocs", "peak bytes");
+        for (const auto &r : results)
+        {
+            printf("%-10s %-8s %12zu %12.0f %10.3f", r.name, r.size, r.output_bytes, r.renders_per_s, r.ns_per_byte);
+            if (AHTT_BENCH_TRACK_ALLOC)
+                printf(" %10zu %12zu\n", r.allocs, r.peak_bytes);
+            else
+                printf(" %10s %12s\n", "n/a", "n/a");
+        }
+    }
+
+    // Keys are written in a fixed order so that two runs can be compared with a plain diff.
+    static void write_json(const acul::path &path, const acul::vector<Result> &results)
+    {
+        acul::stringstream ss;
+        ss << "{\n  \"version\": \"" << AHTT_VERSION_STRING << "\",\n  \"results\": [";
+        for (size_t i = 0; i < results.size(); ++i)
+        {
+            const auto &r = results[i];
+            ss << (i ? "," : "") << "\n    {\"template\": \"" << r.name << "\", \"input\": \"" << r.size
+               << "\", \"output_bytes\": " << r.output_bytes
+               << ", \"renders_per_s\": " << acul::format("%.0f", r.renders_per_s)
+               << ", \"ns_per_byte\": " << acul::format("%.3f", r.ns_per_byte);
+            if (AHTT_BENCH_TRACK_ALLOC) ss << ", \"allocs\": " << r.allocs << ", \"peak_bytes\": " << r.peak_bytes;
+            ss << "}";
+        }
+        ss << "\n  ]\n}\n";
+
+        auto json = ss.str();
+        if (!acul::fs::write_binary(path.str(), json.data(), json.size()))
+            throw acul::runtime_error(acul::format("Failed to write results: %s", path.str().c_str()));
+    }
+} // namespace bench
+
+int main(int argc, char *argv[])
+{
+    args::ArgumentParser parser("ahtt_render_bench " AHTT_VERSION_STRING,
+                                "Measures the render() and render_to() functions generated from bench/templates.");
+    args::HelpFlag help(parser, "help", "Show help", {'h', "help"});
+    args::ValueFlag<size_t> min_time(parser, "ms", "Minimum time per measurement (default: 200)", {"min-time"});
+    args::ValueFlag<std::string> output(parser, "file", "Write results as JSON", {'o', "output"});
+    try
+    {
+        parser.ParseCLI(argc, argv);
+    }
+    catch (const args::Help &)
+    {
+        std::cout << parser;
+        return 0;
+    }
+    catch (const args::ParseError &e)
+    {
+        std::cerr << e.what() << "\n" << parser;
+        return 1;
+    }
+    catch (const args::ValidationError &e)
+    {
+        std::cerr << e.what() << "\n" << parser;
+        return 1;
+    }
+
+    try
+    {
+        auto results = bench::run((min_time ? args::get(min_time) : 200) / 1000.0);
+        bench::print_results(results);
+        if (output) bench::write_json(acul::string(args::get(output).c_str()), results);
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
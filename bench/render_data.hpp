@@ -0,0 +1,31 @@
+#pragma once
+
+#include <acul/string/string.hpp>
+#include <acul/vector.hpp>
+
+namespace ahtt::bench
+{
+    struct Product
+    {
+        int id;
+        acul::string slug;
+        acul::string name;
+        int price;
+        bool in_stock;
+        acul::vector<acul::string> tags;
+    };
+
+    struct Row
+    {
+        int id;
+        acul::string owner;
+        acul::vector<double> values;
+    };
+
+    struct Report
+    {
+        acul::string title;
+        acul::vector<acul::string> columns;
+        acul::vector<Row> rows;
+    };
+} // namespace ahtt::bench
@@ -0,0 +1,235 @@
+#include <acul/io/fs/file.hpp>
+#include <acul/log.hpp>
+#include <args.hxx>
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <linker.hpp>
+#include <translator.hpp>
+#include <version.h>
+#include "corpus.hpp"
+
+namespace bench = ahtt::bench;
+
+struct Options
+{
+    size_t scale = 4;
+    size_t iterations = 10;
+    acul::path output;
+};
+
+enum Phase
+{
+    phase_read,
+    phase_lex,
+    phase_parse,
+    phase_link,
+    phase_translate,
+    phase_emit,
+    phase_count
+};
+
+static const char *phase_names[phase_count] = {"read", "lex", "parse", "link", "translate", "emit"};
+
+struct CaseResult
+{
+    acul::string name;
+    // Size of the template itself and of every file it was linked from.
+    size_t input_bytes = 0, input_lines = 0;
+    size_t linked_bytes = 0, linked_lines = 0;
+    size_t output_bytes = 0;
+    double seconds[phase_count];
+};
+
+static size_t count_lines(const acul::vector<char> &buffer)
+{
+    size_t lines = std::count(buffer.begin(), buffer.end(), '\n');
+    return buffer.empty() || buffer.back() == '\n' ? lines : lines + 1;
+}
+
+static CaseResult run_case(const bench::Case &c, ahtt::FileProvider &files, size_t iterations)
+{
+    using clock = std::chrono::steady_clock;
+    CaseResult r;
+    r.name = c.name;
+    for (auto &s : r.seconds) s = std::numeric_limits<double>::max();
+
+    const acul::path input = c.input / "page.at";
+    for (size_t it = 0; it < iterations; ++it)
+    {
+        clock::time_point t[phase_count + 1];
+        ahtt::IOInfo io;
+        ahtt::Parser p;
+
+        t[phase_read] = clock::now();
+        ahtt::SourceRef source = files.open(input);
+        if (!source)
+            throw acul::runtime_error(acul::format("Failed to read template file: %s", input.str().c_str()));
+        p.arena.retain(source);
+        io.emplace_back(input, source->size());
+
+        t[phase_lex] = clock::now();
+        p.ts = ahtt::lex_with_indents(source->data(), source->size());
+
+        t[phase_parse] = clock::now();
+        p.parse();
+
+        t[phase_link] = clock::now();
+        ahtt::Linker linker(p, files);
+        linker.link(c.input, io);
+
+        t[phase_translate] = clock::now();
+        ahtt::Translator tr(p);
+        tr.parse_tokens();
+
+        t[phase_emit] = clock::now();
+        acul::stringstream ss;
+        tr.write_to_stream(ss, c.name);
+        auto code = ss.str();
+
+        t[phase_count] = clock::now();
+        for (int i = 0; i < phase_count; ++i)
+            r.seconds[i] = std::min(r.seconds[i], std::chrono::duration<double>(t[i + 1] - t[i]).count());
+
+        if (it != 0) continue;
+        r.output_bytes = code.size();
+        for (const auto &dep : io)
+        {
+            acul::vector<char> dep_buffer;
+            files.read(dep.path, dep_buffer);
+            size_t lines = count_lines(dep_buffer);
+            if (&dep == &io.front())
+            {
+                r.input_bytes = dep_buffer.size();
+                r.input_lines = lines;
+            }
+            r.linked_bytes += dep_buffer.size();
+            r.linked_lines += lines;
+        }
+    }
+    return r;
+}
+
+// Read, lex and parse only see the template itself; later phases work on the linked tree.
+static size_t phase_bytes(const CaseResult &r, int phase)
+{
+    return phase < phase_link ? r.input_bytes : r.linked_bytes;
+}
+
+static size_t phase_lines(const CaseResult &r, int phase)
+{
+    return phase < phase_link ? r.input_lines : r.linked_lines;
+}
+
+static void print_results(const acul::vector<CaseResult> &results)
+{
+    printf("%-16s %-10s %12s %12s %14s\n", "case", "phase", "time, us", "MB/s", "lines/s");
+    for (const auto &r : results)
+    {
+        for (int i = 0; i < phase_count; ++i)
+        {
+            double s = r.seconds[i];
+            printf("%-16s %-10s %12.1f %12.1f %14.0f\n", r.name.c_str(), phase_names[i], s * 1e6,
+                   phase_bytes(r, i) / s / 1e6, phase_lines(r, i) / s);
+        }
+    }
+}
+
+// Keys are written in a fixed order so that two runs can be compared with a plain diff.
+static void write_json(const acul::path &path, const Options &options, const acul::vector<CaseResult> &results)
+{
+    acul::stringstream ss;
+    ss << "{\n  \"version\": \"" << AHTT_VERSION_STRING << "\",\n";
+    ss << "  \"scale\": " << options.scale << ",\n  \"iterations\": " << options.iterations << ",\n";
+    ss << "  \"cases\": [";
+    for (size_t c = 0; c < results.size(); ++c)
+    {
+        const auto &r = results[c];
+        ss << (c ? "," : "") << "\n    {\n      \"name\": \"" << r.name << "\",\n";
+        ss << "      \"input_bytes\": " << r.input_bytes << ",\n      \"input_lines\": " << r.input_lines << ",\n";
+        ss << "      \"linked_bytes\": " << r.linked_bytes << ",\n      \"linked_lines\": " << r.linked_lines
+           << ",\n";
+        ss << "      \"output_bytes\": " << r.output_bytes << ",\n      \"phases\": {";
+        for (int i = 0; i < phase_count; ++i)
+        {
+            double s = r.seconds[i];
+            ss << (i ? "," : "") << "\n        \"" << phase_names[i] << "\": {\"seconds\": "
+               << acul::format("%.9f", s) << ", \"mb_per_s\": " << acul::format("%.3f", phase_bytes(r, i) / s / 1e6)
+               << ", \"lines_per_s\": " << acul::format("%.0f", phase_lines(r, i) / s) << "}";
+        }
+        ss << "\n      }\n    }";
+    }
+    ss << "\n  ]\n}\n";
+
+    auto json = ss.str();
+    if (!acul::fs::write_binary(path.str(), json.data(), json.size()))
+        throw acul::runtime_error(acul::format("Failed to write results: %s", path.str().c_str()));
+}
+
+static bool parse_args(int argc, char **argv, Options &options)
+{
+    args::ArgumentParser parser("ahtt_bench " AHTT_VERSION_STRING,
+                                "Transpiles a generated template corpus and reports per-phase throughput.");
+    args::HelpFlag help(parser, "help", "Show help", {'h', "help"});
+    args::ValueFlag<size_t> scale(parser, "n", "Corpus size multiplier (default: 4)", {"scale"});
+    args::ValueFlag<size_t> iterations(parser, "n", "Runs per case; the fastest is reported (default: 10)",
+                                       {'n', "iterations"});
+    args::ValueFlag<std::string> output(parser, "file", "Write results as JSON", {'o', "output"});
+    try
+    {
+        parser.ParseCLI(argc, argv);
+    }
+    catch (const args::Help &)
+    {
+        std::cout << parser;
+        return false;
+    }
+    catch (const args::ParseError &e)
+    {
+        std::cerr << e.what() << "\n" << parser;
+        exit(EXIT_FAILURE);
+    }
+    catch (const args::ValidationError &e)
+    {
+        std::cerr << e.what() << "\n" << parser;
+        exit(EXIT_FAILURE);
+    }
+    if (scale) options.scale = std::max<size_t>(args::get(scale), 1);
+    if (iterations) options.iterations = std::max<size_t>(args::get(iterations), 1);
+    if (output) options.output = acul::string(args::get(output).c_str());
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    Options options;
+    if (!parse_args(argc, argv, options)) return 0;
+
+    acul::task::service_dispatch sd;
+    sd.run();
+    auto *ls = acul::alloc<acul::log::log_service>();
+    sd.register_service(ls);
+    ls->level = acul::log::level::warn;
+    auto *app_logger = ls->add_logger<acul::log::console_logger>("console");
+    app_logger->set_pattern("[%(level_name)] %(message)\n");
+    acul::log::set_default_logger(app_logger);
+
+    int ret = EXIT_SUCCESS;
+    try
+    {
+        ahtt::MemoryFileProvider files;
+        auto cases = bench::generate_corpus(files, "corpus", options.scale);
+
+        acul::vector<CaseResult> results;
+        for (const auto &c : cases) results.push_back(run_case(c, files, options.iterations));
+        print_results(results);
+        if (!options.output.str().empty()) write_json(options.output, options, results);
+    }
+    catch (const std::exception &e)
+    {
+        LOG_ERROR("%s", e.what());
+        ret = EXIT_FAILURE;
+    }
+    ls->await();
+    return ret;
+}
@@ -0,0 +1,250 @@
+#include <acul/log.hpp>
+#include <args.hxx>
+#include <version.h>
+#include "cache.hpp"
+#include "disk_cache.hpp"
+#include "driver.hpp"
+#include "profiler.hpp"
+#include "server.hpp"
+#include "watch.hpp"
+#include "worker_pool.hpp"
+
+#define AHTT_ARGS_ERR     -1
+#define AHTT_ARGS_SUCCESS 0
+#define AHTT_ARGS_HELP    1
+#define AHTT_ARGS_VERSION 2
+
+struct Args
+{
+    acul::path input;
+    acul::path base_dir;
+    acul::string output;
+    acul::string dep_file;
+    acul::path batch;
+    acul::path cache_dir;
+    acul::path serve;
+    acul::path connect;
+    acul::path profile;
+    size_t jobs = 0;
+    bool watch = false;
+    bool ast_files = false;
+};
+
+void print_version() { std::cout << "ahtt version " << AHTT_VERSION_STRING << "\n"; }
+
+int parse_args(int argc, char **argv, Args &args)
+{
+    args::ArgumentParser parser("ahtt " AHTT_VERSION_STRING);
+    args::HelpFlag help(parser, "help", "Show help", {'h', "help"});
+    args::Flag version(parser, "version", "Show version", {'v', "version"}, args::Options::KickOut);
+
+    args::ValueFlag<std::string> input(parser, "file", "Input .at template", {'i', "input"});
+    args::ValueFlag<std::string> output(parser, "dir", "Output .hpp file", {'o', "output"});
+    args::ValueFlag<std::string> base_dir(parser, "dir", "Base directory", {"base-dir"});
+    args::ValueFlag<std::string> dep_file(parser, "file", "Dependency file", {"dep-file"});
+    args::ValueFlag<std::string> batch(parser, "file", "Batch manifest: '<input> <output> [dep-file]' per line",
+                                       {"batch"});
+    args::ValueFlag<size_t> jobs(parser, "n", "Number of workers for batches and include reads (default: all cores)",
+                                 {'j', "jobs"});
+    args::ValueFlag<std::string> cache_dir(parser, "dir", "Persistent transpile cache directory", {"cache-dir"});
+    args::Flag ast_files(parser, "ast-files", "Share parsed layouts and partials between processes via .atb files",
+                         {"ast-files"});
+    args::ValueFlag<std::string> serve(parser, "socket", "Serve transpile requests on a Unix socket", {"serve"});
+    args::ValueFlag<std::string> connect(parser, "socket", "Send the request to a running --serve instance",
+                                         {"connect"});
+    args::Flag watch(parser, "watch", "Keep running and re-transpile templates whose dependencies change",
+                     {"watch"});
+    args::ValueFlag<std::string> profile(parser, "file", "Write a Chrome trace of the transpile phases", {"profile"});
+
+    try
+    {
+        parser.ParseCLI(argc, argv);
+    }
+    catch (const args::Help &)
+    {
+        std::cout << parser;
+        return AHTT_ARGS_HELP;
+    }
+    catch (const args::ParseError &e)
+    {
+        std::cerr << e.what() << "\n" << parser;
+        return AHTT_ARGS_ERR;
+    }
+    catch (const args::ValidationError &e)
+    {
+        std::cerr << e.what() << "\n" << parser;
+        return AHTT_ARGS_ERR;
+    }
+    catch (const args::Completion &c)
+    {
+        std::cout << c.what();
+        return AHTT_ARGS_HELP;
+    }
+    catch (...)
+    {
+        std::cerr << "Unknown argument error\n";
+        return AHTT_ARGS_ERR;
+    }
+
+    if (version)
+    {
+        print_version();
+        return AHTT_ARGS_VERSION;
+    }
+
+    if (base_dir) args.base_dir = acul::string(args::get(base_dir).c_str());
+    if (cache_dir) args.cache_dir = acul::string(args::get(cache_dir).c_str());
+    if (jobs) args.jobs = args::get(jobs);
+    args.watch = static_cast<bool>(watch);
+    args.ast_files = static_cast<bool>(ast_files);
+    if (profile) args.profile = acul::string(args::get(profile).c_str());
+    if (serve)
+    {
+        if (input || output || dep_file || batch || connect || watch)
+        {
+            std::cerr << "--serve cannot be combined with other modes\n" << parser;
+            return AHTT_ARGS_ERR;
+        }
+        args.serve = acul::string(args::get(serve).c_str());
+        return AHTT_ARGS_SUCCESS;
+    }
+    if (batch)
+    {
+        if (input || output || dep_file)
+        {
+            std::cerr << "--batch cannot be combined with --input, --output or --dep-file\n" << parser;
+            return AHTT_ARGS_ERR;
+        }
+        if (connect)
+        {
+            std::cerr << "--connect cannot be combined with --batch\n" << parser;
+            return AHTT_ARGS_ERR;
+        }
+        args.batch = acul::string(args::get(batch).c_str());
+        return AHTT_ARGS_SUCCESS;
+    }
+
+    if (!input || !output)
+    {
+        std::cerr << "--input and --output are required\n" << parser;
+        return AHTT_ARGS_ERR;
+    }
+    args.input = acul::string(args::get(input).c_str());
+    args.output = acul::string(args::get(output).c_str());
+    if (dep_file) args.dep_file = acul::string(args::get(dep_file).c_str());
+    if (connect)
+    {
+        if (watch || profile)
+        {
+            std::cerr << "--connect cannot be combined with --watch or --profile\n" << parser;
+            return AHTT_ARGS_ERR;
+        }
+        args.connect = acul::string(args::get(connect).c_str());
+    }
+    return AHTT_ARGS_SUCCESS;
+}
+
+int main(int argc, char *argv[])
+{
+    Args args;
+    switch (parse_args(argc, argv, args))
+    {
+        case AHTT_ARGS_HELP:
+        case AHTT_ARGS_VERSION:
+            return 0;
+        case AHTT_ARGS_ERR:
+            return 1;
+        default:
+            break;
+    }
+
+    // Thin client: the server does the work and logging, so skip the local services entirely.
+    if (!args.connect.str().empty())
+    {
+        acul::string error;
+        if (ahtt::request_transpile(args.connect, {args.input, args.output, args.dep_file}, args.base_dir, error))
+            return 0;
+        std::cerr << error.c_str() << "\n";
+        return 1;
+    }
+
+    acul::task::service_dispatch sd;
+    sd.run();
+    auto *ls = acul::alloc<acul::log::log_service>();
+    sd.register_service(ls);
+    ls->level = acul::log::level::trace;
+    auto *app_logger = ls->add_logger<acul::log::console_logger>("console");
+    app_logger->set_pattern("[%(level_name)] %(message)\n");
+    acul::log::set_default_logger(app_logger);
+
+    acul::unique_ptr<ahtt::Profiler> profiler;
+    if (!args.profile.str().empty())
+    {
+        profiler = acul::make_unique<ahtt::Profiler>();
+        ahtt::set_active_profiler(profiler.get());
+    }
+
+    int ret = EXIT_SUCCESS;
+    try
+    {
+        // Daemons re-parse an edited template only around the edit.
+        ahtt::ParseCache parse_cache(!args.serve.str().empty() || args.watch);
+        if (args.ast_files) parse_cache.set_ast_files(AHTT_VERSION_STRING);
+        acul::unique_ptr<ahtt::DiskCache> disk_cache;
+        if (!args.cache_dir.str().empty())
+            disk_cache = acul::make_unique<ahtt::DiskCache>(
+                args.cache_dir, acul::format("%s/%d", AHTT_VERSION_STRING, ahtt::codegen_revision));
+        ahtt::Session session{args.base_dir, &parse_cache, disk_cache.get()};
+        // Daemons keep parsed templates across edits; a mapped file truncated in place would fault.
+        ahtt::DiskFileProvider read_files(false);
+        if (!args.serve.str().empty() || args.watch) session.files = &read_files;
+
+        if (!args.serve.str().empty())
+            ahtt::serve(args.serve, session, args.jobs ? args.jobs : ahtt::WorkerPool::default_size());
+        else
+        {
+            acul::vector<ahtt::Job> jobs;
+            if (!args.batch.str().empty())
+                ahtt::load_manifest(args.batch, jobs);
+            else
+                jobs.push_back({args.input, args.output, args.dep_file});
+
+            size_t threads = args.jobs ? args.jobs : ahtt::WorkerPool::default_size();
+            if (args.watch)
+                ahtt::watch(jobs, session, threads);
+            else if (jobs.size() == 1 && args.batch.str().empty())
+            {
+                ahtt::WorkerPool pool(threads);
+                session.pool = &pool;
+                ahtt::IOInfo io;
+                ahtt::transpile(jobs.front(), session, io);
+            }
+            else
+            {
+                size_t failed = ahtt::run_batch(jobs, session, threads);
+                if (failed != 0)
+                {
+                    LOG_ERROR("%zu of %zu templates failed", failed, jobs.size());
+                    ret = EXIT_FAILURE;
+                }
+            }
+        }
+    }
+    catch (const std::exception &e)
+    {
+        LOG_ERROR("%s", e.what());
+        ret = EXIT_FAILURE;
+    }
+    if (profiler)
+    {
+        ahtt::set_active_profiler(nullptr);
+        if (!profiler->write_trace(args.profile))
+        {
+            LOG_ERROR("Failed to write profile: %s", args.profile.str().c_str());
+            ret = EXIT_FAILURE;
+        }
+        std::cerr << profiler->summary().c_str() << "\n";
+    }
+    ls->await();
+    return ret;
+}
\ No newline at end of file
@@ -0,0 +1,30 @@
+#include "ahtt.hpp"
+#include "linker.hpp"
+#include "translator.hpp"
+
+namespace ahtt
+{
+    Result transpile(const Request &request, FileProvider &files, ParseCache *cache, WorkerPool *pool)
+    {
+        Result result;
+        Parser p;
+        if (cache)
+            cache->parse_file(request.input, p, result.deps, files);
+        else
+            load_template(request.input, p, result.deps, files);
+        Linker l(p, files, cache, pool);
+        l.link(request.base_dir, result.deps);
+        Translator tr(p);
+        {
+            ProfileScope scope("translate", &request.input);
+            if (scope.active()) scope.nodes = count_nodes(p.ast);
+            tr.parse_tokens();
+        }
+        ProfileScope scope("write_to_stream", &request.input);
+        acul::stringstream ss;
+        tr.write_to_stream(ss, request.name.empty() ? request.input.stem() : request.name);
+        result.code = ss.str();
+        scope.bytes = result.code.size();
+        return result;
+    }
+} // namespace ahtt
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "cache.hpp"
+#include "files.hpp"
+
+namespace ahtt
+{
+    // Revision of the format of the generated code, bumped with every change to what the translator emits, so
+    // that results cached across runs are not restored by a build that would generate something else.
+    inline constexpr int codegen_revision = 12;
+
+    struct Request
+    {
+        acul::path input;
+        // Directory that include and extends paths are resolved against.
+        acul::path base_dir;
+        // Namespace of the generated code; defaults to the stem of `input`.
+        acul::string name;
+    };
+
+    struct Result
+    {
+        acul::string code;
+        // Every file the code was built from; the input comes first.
+        IOInfo deps;
+    };
+
+    class WorkerPool;
+
+    // Transpiles one template entirely in memory. All reads go through `files`; layouts and includes
+    // are shared through `cache` when one is given and read ahead on `pool` when one is given. Throws
+    // acul::runtime_error on invalid templates.
+    Result transpile(const Request &request, FileProvider &files, ParseCache *cache = nullptr,
+                     WorkerPool *pool = nullptr);
+} // namespace ahtt
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <acul/string/string_view.hpp>
+#include <acul/vector.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <type_traits>
+
+namespace ahtt
+{
+    // Bump allocator that owns the nodes of one parse. Objects never move and are destroyed together
+    // with the arena, in reverse order of creation. The sources node strings point into are retained
+    // here too, so a tree stays valid for as long as its arena.
+    class NodeArena
+    {
+    public:
+        NodeArena() = default;
+        NodeArena(NodeArena &&other) noexcept { take(other); }
+        NodeArena &operator=(NodeArena &&other) noexcept
+        {
+            if (this != &other)
+            {
+                clear();
+                take(other);
+            }
+            return *this;
+        }
+        ~NodeArena() { clear(); }
+
+        template <class T, class... Args>
+        T *make(Args &&...args)
+        {
+            T *p = new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+            if constexpr (!std::is_trivially_destructible_v<T>)
+                _dtors.push_back({p, [](void *obj) { static_cast<T *>(obj)->~T(); }});
+            return p;
+        }
+
+        // Uninitialised storage for `count` objects of trivial type T, e.g. the child lists of a cloned tree.
+        template <class T>
+        T *make_array(size_t count)
+        {
+            static_assert(std::is_trivially_destructible_v<T>);
+            return count ? static_cast<T *>(allocate(sizeof(T) * count, alignof(T))) : nullptr;
+        }
+
+        // Makes room for `bytes` of objects, `objects` of which need destruction, so that a tree of known size is
+        // laid out in one block.
+        void reserve(size_t bytes, size_t objects)
+        {
+            _dtors.reserve(_dtors.size() + objects);
+            if (bytes <= _left) return;
+            size_t block_size = std::max(_next_block_size, bytes);
+            _blocks.emplace_back(new char[block_size]);
+            _head = _blocks.back().get();
+            _left = block_size;
+            _next_block_size = std::min(_next_block_size * 2, max_block_size);
+        }
+
+        // Copies `s` into the arena, for node text that does not exist verbatim in any source.
+        acul::string_view store(acul::string_view s)
+        {
+            if (s.empty()) return {};
+            char *p = static_cast<char *>(allocate(s.size(), 1));
+            memcpy(p, s.data(), s.size());
+            return {p, s.size()};
+        }
+
+        // Keeps `owner` alive as long as the nodes, e.g. the source their strings point into.
+        void retain(std::shared_ptr<const void> owner) { _retained.push_back(std::move(owner)); }
+
+        // Keeps the nodes of `other` alive for as long as this arena, e.g. after an included template
+        // was spliced into this tree.
+        void adopt(NodeArena &&other)
+        {
+            if (other._blocks.empty() && other._children.empty() && other._retained.empty()) return;
+            _children.push_back(std::make_unique<NodeArena>(std::move(other)));
+        }
+
+        void clear()
+        {
+            for (size_t i = _dtors.size(); i-- > 0;) _dtors[i].destroy(_dtors[i].obj);
+            _dtors.clear();
+            _children.clear();
+            _retained.clear();
+            _blocks.clear();
+            _head = nullptr;
+            _left = 0;
+        }
+
+    private:
+        struct Dtor
+        {
+            void *obj;
+            void (*destroy)(void *);
+        };
+
+        static constexpr size_t min_block_size = 16 * 1024;
+        static constexpr size_t max_block_size = 1024 * 1024;
+
+        acul::vector<std::unique_ptr<char[]>> _blocks;
+        acul::vector<Dtor> _dtors;
+        acul::vector<std::unique_ptr<NodeArena>> _children;
+        acul::vector<std::shared_ptr<const void>> _retained;
+        char *_head = nullptr;
+        size_t _left = 0;
+        size_t _next_block_size = min_block_size;
+
+        void take(NodeArena &other)
+        {
+            _blocks = std::move(other._blocks);
+            _dtors = std::move(other._dtors);
+            _children = std::move(other._children);
+            _retained = std::move(other._retained);
+            _head = other._head;
+            _left = other._left;
+            _next_block_size = other._next_block_size;
+            other._head = nullptr;
+            other._left = 0;
+            other._next_block_size = min_block_size;
+        }
+
+        void *allocate(size_t size, size_t align)
+        {
+            size_t pad = (align - reinterpret_cast<uintptr_t>(_head) % align) % align;
+            if (pad + size > _left)
+            {
+                size_t block_size = std::max(_next_block_size, size + align);
+                _blocks.emplace_back(new char[block_size]);
+                _head = _blocks.back().get();
+                _left = block_size;
+                _next_block_size = std::min(_next_block_size * 2, max_block_size);
+                pad = (align - reinterpret_cast<uintptr_t>(_head) % align) % align;
+            }
+            void *p = _head + pad;
+            _head += pad + size;
+            _left -= pad + size;
+            return p;
+        }
+    };
+} // namespace ahtt
@@ -0,0 +1,481 @@
+#include "ast_file.hpp"
+#include <acul/log.hpp>
+#include <cstring>
+#include "disk_cache.hpp"
+#include "file_utils.hpp"
+#include "profiler.hpp"
+
+#define AHTT_AST_FILE_MAGIC   "ahttast"
+#define AHTT_AST_FILE_VERSION 1
+
+namespace ahtt
+{
+    namespace
+    {
+        constexpr uint32_t npos = UINT32_MAX;
+        // Files are read with the layout of the writing host; one written elsewhere fails this check.
+        constexpr uint32_t byte_order = 0x01020304;
+
+        struct StrRef
+        {
+            uint32_t offset, size;
+        };
+
+        // Sections follow in this order: deps, nodes, lists, args, blocks, includes, strings.
+        struct Header
+        {
+            char magic[8];
+            uint32_t version;
+            uint32_t byte_order;
+            uint64_t salt;
+            uint32_t dep_count, node_count, list_count, arg_count, block_count, include_count;
+            uint32_t root_first, root_count;
+            uint32_t extends;
+            uint32_t strings_size;
+        };
+
+        struct DepRecord
+        {
+            uint64_t hash, size;
+            StrRef path;
+        };
+
+        // `list` indexes the children of a parent node or the text nodes of a text group; `args` the arguments
+        // of a mixin.
+        struct NodeRecord
+        {
+            uint8_t kind, mode, flag, reserved;
+            int32_t line, col;
+            StrRef text;
+            uint32_t list_first, list_count;
+            uint32_t args_first, args_count;
+        };
+
+        struct SlotRecord
+        {
+            uint32_t node, parent, offset;
+        };
+
+        static_assert(sizeof(Header) % 8 == 0 && sizeof(DepRecord) % 8 == 0, "sections must stay aligned");
+
+        class Writer
+        {
+        public:
+            acul::vector<NodeRecord> nodes;
+            acul::vector<uint32_t> lists;
+            acul::vector<StrRef> args;
+            acul::vector<char> strings;
+
+            StrRef str(acul::string_view s)
+            {
+                StrRef ref{static_cast<uint32_t>(strings.size()), static_cast<uint32_t>(s.size())};
+                strings.insert(strings.end(), s.data(), s.data() + s.size());
+                return ref;
+            }
+
+            uint32_t add(const INode *node)
+            {
+                auto it = _ids.find(node);
+                if (it != _ids.end()) return it->second;
+                uint32_t id = static_cast<uint32_t>(nodes.size());
+                _ids.emplace(node, id);
+                nodes.push_back({static_cast<uint8_t>(node->kind()), 0, 0, 0, node->pos.line, node->pos.col, {}, 0, 0,
+                                 0, 0});
+
+                NodeRecord rec = nodes[id];
+                acul::vector<uint32_t> list;
+                switch (node->kind())
+                {
+                    case INode::Kind::text:
+                        rec.text = str(static_cast<const TextNode *>(node)->text);
+                        break;
+                    case INode::Kind::text_group:
+                        for (const auto *text : static_cast<const TextGroupNode *>(node)->text_nodes)
+                            list.push_back(add(text));
+                        break;
+                    case INode::Kind::code:
+                        rec.text = str(static_cast<const CodeNode *>(node)->code);
+                        break;
+                    case INode::Kind::expr:
+                        rec.text = str(static_cast<const ExprNode *>(node)->expr);
+                        break;
+                    case INode::Kind::html:
+                        rec.text = str(static_cast<const HTMLNode *>(node)->head);
+                        break;
+                    case INode::Kind::extends:
+                        rec.text = str(static_cast<const ExtendsNode *>(node)->path);
+                        break;
+                    case INode::Kind::include:
+                    {
+                        auto *include = static_cast<const IncludeNode *>(node);
+                        rec.text = str(include->path);
+                        rec.mode = static_cast<uint8_t>(include->mode);
+                        break;
+                    }
+                    case INode::Kind::block:
+                    {
+                        auto *block = static_cast<const BlockNode *>(node);
+                        rec.text = str(block->name);
+                        rec.mode = static_cast<uint8_t>(block->mode);
+                        break;
+                    }
+                    case INode::Kind::mixin_decl:
+                    case INode::Kind::mixin_call:
+                    {
+                        auto *mixin = static_cast<const MixinDecl *>(node);
+                        rec.text = str(mixin->name);
+                        rec.flag = mixin->has_block;
+                        rec.args_first = static_cast<uint32_t>(args.size());
+                        rec.args_count = static_cast<uint32_t>(mixin->args.size());
+                        for (const auto &arg : mixin->args) args.push_back(str(arg));
+                        break;
+                    }
+                    case INode::Kind::external:
+                        rec.flag = static_cast<const ExternalNode *>(node)->is_struct;
+                        break;
+                }
+                if (is_parent_kind(node->kind()))
+                    for (const auto *child : static_cast<const ParentNode *>(node)->children)
+                        list.push_back(child ? add(child) : npos);
+
+                rec.list_first = static_cast<uint32_t>(lists.size());
+                rec.list_count = static_cast<uint32_t>(list.size());
+                lists.insert(lists.end(), list.begin(), list.end());
+                nodes[id] = rec;
+                return id;
+            }
+
+            uint32_t id(const INode *node) const
+            {
+                if (!node) return npos;
+                auto it = _ids.find(node);
+                return it == _ids.end() ? npos : it->second;
+            }
+
+        private:
+            acul::hashmap<const INode *, uint32_t> _ids;
+        };
+
+        template <class T>
+        static void append(acul::vector<char> &out, const T *data, size_t count)
+        {
+            auto *bytes = reinterpret_cast<const char *>(data);
+            out.insert(out.end(), bytes, bytes + count * sizeof(T));
+        }
+
+        // Bounds-checked view of the sections of a mapped file.
+        class Reader
+        {
+        public:
+            Reader(const char *data, size_t size) : _data(data), _size(size) {}
+
+            template <class T>
+            bool section(size_t count, const char *&out)
+            {
+                if (count > (_size - _offset) / sizeof(T)) return false;
+                out = _data + _offset;
+                _offset += count * sizeof(T);
+                return true;
+            }
+
+            template <class T>
+            static T at(const char *section, size_t i)
+            {
+                T value;
+                memcpy(&value, section + i * sizeof(T), sizeof(T));
+                return value;
+            }
+
+            bool done() const { return _offset == _size; }
+
+        private:
+            const char *_data;
+            size_t _size;
+            size_t _offset = sizeof(Header);
+        };
+    } // namespace
+
+    bool write_ast_file(const acul::path &path, const Parser &p, const IOInfo &deps, uint64_t salt)
+    {
+        ProfileScope scope("write_ast_file", &path);
+        Writer w;
+        acul::vector<DepRecord> dep_records;
+        // Hash the bytes that were parsed: files reopened here may already hold a later edit.
+        for (const auto &dep : deps)
+        {
+            if (!dep.source) return false;
+            const auto &source = dep.source;
+            dep_records.push_back({fnv1a(source->data(), source->size()), source->size(), w.str(dep.path.str())});
+        }
+
+        acul::vector<uint32_t> roots;
+        for (const auto *node : p.ast) roots.push_back(node ? w.add(node) : npos);
+        uint32_t root_first = static_cast<uint32_t>(w.lists.size());
+        w.lists.insert(w.lists.end(), roots.begin(), roots.end());
+
+        // Slots of nodes that are not in the tree cannot be written.
+        auto slots = [&w](const acul::vector<ReplaceSlot> &in, acul::vector<SlotRecord> &out) {
+            for (const auto &slot : in)
+            {
+                SlotRecord rec{w.id(slot.node), w.id(slot.parent), static_cast<uint32_t>(slot.offset)};
+                if (rec.node == npos || (slot.parent && rec.parent == npos)) return false;
+                out.push_back(rec);
+            }
+            return true;
+        };
+        acul::vector<SlotRecord> blocks, includes;
+        if (!slots(p.replace_map.blocks, blocks) || !slots(p.replace_map.includes, includes)) return false;
+        if (w.strings.size() > UINT32_MAX || w.lists.size() > UINT32_MAX) return false;
+
+        Header header{};
+        memcpy(header.magic, AHTT_AST_FILE_MAGIC, sizeof(header.magic));
+        header.version = AHTT_AST_FILE_VERSION;
+        header.byte_order = byte_order;
+        header.salt = salt;
+        header.dep_count = static_cast<uint32_t>(dep_records.size());
+        header.node_count = static_cast<uint32_t>(w.nodes.size());
+        header.list_count = static_cast<uint32_t>(w.lists.size());
+        header.arg_count = static_cast<uint32_t>(w.args.size());
+        header.block_count = static_cast<uint32_t>(blocks.size());
+        header.include_count = static_cast<uint32_t>(includes.size());
+        header.root_first = root_first;
+        header.root_count = static_cast<uint32_t>(roots.size());
+        header.extends = w.id(p.extends);
+        header.strings_size = static_cast<uint32_t>(w.strings.size());
+
+        acul::vector<char> out;
+        append(out, &header, 1);
+        append(out, dep_records.data(), dep_records.size());
+        append(out, w.nodes.data(), w.nodes.size());
+        append(out, w.lists.data(), w.lists.size());
+        append(out, w.args.data(), w.args.size());
+        append(out, blocks.data(), blocks.size());
+        append(out, includes.data(), includes.size());
+        append(out, w.strings.data(), w.strings.size());
+        scope.bytes = out.size();
+        scope.nodes = w.nodes.size();
+        return write_atomic(path.str(), out.data(), out.size());
+    }
+
+    static INode *make_node(const NodeRecord &rec, acul::string_view text, NodeArena &arena)
+    {
+        switch (static_cast<INode::Kind>(rec.kind))
+        {
+            case INode::Kind::text:
+            {
+                auto *node = arena.make<TextNode>();
+                node->text = text;
+                return node;
+            }
+            case INode::Kind::text_group:
+                return arena.make<TextGroupNode>();
+            case INode::Kind::code:
+            {
+                auto *node = arena.make<CodeNode>();
+                node->code = text;
+                return node;
+            }
+            case INode::Kind::expr:
+            {
+                auto *node = arena.make<ExprNode>();
+                node->expr = text;
+                return node;
+            }
+            case INode::Kind::html:
+            {
+                auto *node = arena.make<HTMLNode>();
+                node->head = text;
+                return node;
+            }
+            case INode::Kind::extends:
+            {
+                auto *node = arena.make<ExtendsNode>();
+                node->path = acul::string(text);
+                return node;
+            }
+            case INode::Kind::include:
+            {
+                auto *node = arena.make<IncludeNode>();
+                node->path = acul::string(text);
+                node->mode = static_cast<IncludeNode::Mode>(rec.mode);
+                return node;
+            }
+            case INode::Kind::block:
+            {
+                auto *node = arena.make<BlockNode>();
+                node->name = acul::string(text);
+                node->mode = static_cast<BlockNode::Mode>(rec.mode);
+                return node;
+            }
+            case INode::Kind::mixin_decl:
+            case INode::Kind::mixin_call:
+            {
+                MixinDecl *node = rec.kind == static_cast<uint8_t>(INode::Kind::mixin_call) ? arena.make<MixinCall>()
+                                                                                            : arena.make<MixinDecl>();
+                node->name = acul::string(text);
+                node->has_block = rec.flag;
+                return node;
+            }
+            case INode::Kind::external:
+            {
+                auto *node = arena.make<ExternalNode>();
+                node->is_struct = rec.flag;
+                return node;
+            }
+            default:
+                return nullptr;
+        }
+    }
+
+    bool read_ast_file(const acul::path &path, Parser &out, IOInfo &deps, uint64_t salt, FileProvider &files,
+                       acul::vector<uint64_t> *stamps)
+    {
+        ProfileScope scope("read_ast_file", &path);
+        SourceRef source = files.open(path);
+        if (!source || source->size() < sizeof(Header)) return false;
+        const char *data = source->data();
+        Header header;
+        memcpy(&header, data, sizeof(header));
+        if (memcmp(header.magic, AHTT_AST_FILE_MAGIC, sizeof(header.magic)) != 0 ||
+            header.version != AHTT_AST_FILE_VERSION || header.byte_order != byte_order || header.salt != salt)
+            return false;
+
+        Reader r(data, source->size());
+        const char *dep_sec, *node_sec, *list_sec, *arg_sec, *block_sec, *include_sec, *strings;
+        if (!r.section<DepRecord>(header.dep_count, dep_sec) || !r.section<NodeRecord>(header.node_count, node_sec) ||
+            !r.section<uint32_t>(header.list_count, list_sec) || !r.section<StrRef>(header.arg_count, arg_sec) ||
+            !r.section<SlotRecord>(header.block_count, block_sec) ||
+            !r.section<SlotRecord>(header.include_count, include_sec) ||
+            !r.section<char>(header.strings_size, strings) || !r.done())
+            return false;
+
+        auto text_of = [&](StrRef ref, acul::string_view &sv) {
+            if (ref.offset > header.strings_size || ref.size > header.strings_size - ref.offset) return false;
+            sv = acul::string_view(strings + ref.offset, ref.size);
+            return true;
+        };
+        auto in_lists = [&](uint32_t first, uint32_t count) {
+            return first <= header.list_count && count <= header.list_count - first;
+        };
+
+        // Inputs are stamped before they are hashed, so an edit in between makes the stamp stale, not the entry.
+        IOInfo inputs;
+        acul::vector<uint64_t> input_stamps;
+        for (uint32_t i = 0; i < header.dep_count; ++i)
+        {
+            auto dep = Reader::at<DepRecord>(dep_sec, i);
+            acul::string_view dep_path;
+            if (!text_of(dep.path, dep_path)) return false;
+            acul::path file{acul::string(dep_path)};
+            if (stamps) input_stamps.push_back(files.stamp(file));
+            SourceRef input = files.open(file);
+            if (!input || input->size() != dep.size || fnv1a(input->data(), input->size()) != dep.hash) return false;
+            inputs.emplace_back(file, input->size(), input);
+        }
+        if (inputs.empty()) return false;
+
+        Parser p;
+        acul::vector<INode *> nodes(header.node_count);
+        for (uint32_t i = 0; i < header.node_count; ++i)
+        {
+            auto rec = Reader::at<NodeRecord>(node_sec, i);
+            acul::string_view text;
+            if (!text_of(rec.text, text) || !in_lists(rec.list_first, rec.list_count)) return false;
+            nodes[i] = make_node(rec, text, p.arena);
+            if (!nodes[i]) return false;
+            nodes[i]->pos = {rec.line, rec.col};
+        }
+
+        // Nodes are written before their children, so a child with a lower index means a corrupt file.
+        auto node_at = [&](uint32_t id, INode *&node) {
+            if (id == npos)
+                node = nullptr;
+            else if (id < header.node_count)
+                node = nodes[id];
+            else
+                return false;
+            return true;
+        };
+        // Every list becomes the range of one arena array at the offset it has in the file.
+        INode **child_lists = p.arena.make_array<INode *>(header.list_count);
+        TextNode **text_lists = p.arena.make_array<TextNode *>(header.list_count);
+        for (uint32_t i = 0; i < header.node_count; ++i)
+        {
+            auto rec = Reader::at<NodeRecord>(node_sec, i);
+            INode *node = nodes[i];
+            if (node->kind() == INode::Kind::text_group)
+            {
+                auto &texts = static_cast<TextGroupNode *>(node)->text_nodes;
+                texts = PtrList<TextNode>(text_lists + rec.list_first, rec.list_count);
+                for (uint32_t k = 0; k < rec.list_count; ++k)
+                {
+                    INode *text;
+                    uint32_t id = Reader::at<uint32_t>(list_sec, rec.list_first + k);
+                    if (id <= i || !node_at(id, text) || !text || text->kind() != INode::Kind::text) return false;
+                    texts[k] = static_cast<TextNode *>(text);
+                }
+            }
+            else if (is_parent_kind(node->kind()))
+            {
+                auto &children = static_cast<ParentNode *>(node)->children;
+                children = NodeList(child_lists + rec.list_first, rec.list_count);
+                for (uint32_t k = 0; k < rec.list_count; ++k)
+                {
+                    uint32_t id = Reader::at<uint32_t>(list_sec, rec.list_first + k);
+                    if ((id != npos && id <= i) || !node_at(id, children[k])) return false;
+                }
+            }
+            else if (rec.list_count)
+                return false;
+
+            if (node->kind() == INode::Kind::mixin_decl || node->kind() == INode::Kind::mixin_call)
+            {
+                if (rec.args_first > header.arg_count || rec.args_count > header.arg_count - rec.args_first)
+                    return false;
+                auto &args = static_cast<MixinDecl *>(node)->args;
+                for (uint32_t k = 0; k < rec.args_count; ++k)
+                {
+                    acul::string_view arg;
+                    if (!text_of(Reader::at<StrRef>(arg_sec, rec.args_first + k), arg)) return false;
+                    args.emplace_back(arg);
+                }
+            }
+        }
+
+        if (!in_lists(header.root_first, header.root_count)) return false;
+        p.ast.resize(header.root_count);
+        for (uint32_t k = 0; k < header.root_count; ++k)
+            if (!node_at(Reader::at<uint32_t>(list_sec, header.root_first + k), p.ast[k])) return false;
+
+        auto slot_at = [&](const char *section, uint32_t i, ReplaceSlot &slot) {
+            auto rec = Reader::at<SlotRecord>(section, i);
+            slot.offset = rec.offset;
+            return node_at(rec.node, slot.node) && slot.node && node_at(rec.parent, slot.parent);
+        };
+        for (uint32_t i = 0; i < header.block_count; ++i)
+        {
+            ReplaceSlot slot;
+            if (!slot_at(block_sec, i, slot) || slot.node->kind() != INode::Kind::block) return false;
+            p.replace_map.add_block(static_cast<BlockNode *>(slot.node)->name, slot);
+        }
+        for (uint32_t i = 0; i < header.include_count; ++i)
+        {
+            ReplaceSlot slot;
+            if (!slot_at(include_sec, i, slot) || slot.node->kind() != INode::Kind::include) return false;
+            p.replace_map.includes.push_back(slot);
+        }
+        INode *extends;
+        if (!node_at(header.extends, extends) || (extends && extends->kind() != INode::Kind::extends)) return false;
+        p.extends = static_cast<ExtendsNode *>(extends);
+
+        // Node text points into the mapping.
+        p.arena.retain(source);
+        out = std::move(p);
+        deps.insert(deps.end(), inputs.begin(), inputs.end());
+        if (stamps) stamps->insert(stamps->end(), input_stamps.begin(), input_stamps.end());
+        LOG_INFO("Loaded parsed template: %s", path.str().c_str());
+        scope.bytes = source->size();
+        scope.nodes = header.node_count;
+        return true;
+    }
+} // namespace ahtt
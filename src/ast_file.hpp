@@ -0,0 +1,22 @@
+#pragma once
+
+#include "files.hpp"
+#include "parser.hpp"
+
+namespace ahtt
+{
+    // Binary form of a linked parse (an include-resolved partial or a layout skeleton), written next to its
+    // source so that other processes map it instead of parsing. The file holds fixed-size node records, index
+    // lists, the replace slots and one string table that node text points into once loaded, headed by a format
+    // version, a salt and the content hash of every file the parse was built from.
+    //
+    // Writes `p`, built from `deps`, to `path`, hashing the sources the parse read. Returns false if it cannot
+    // be written or a dependency carries no source.
+    bool write_ast_file(const acul::path &path, const Parser &p, const IOInfo &deps, uint64_t salt);
+
+    // Maps `path` and fills `out` with the parse it holds if it was written with `salt` and every recorded input
+    // still has its recorded content, appending the inputs to `deps` and, when given, their stamps taken before
+    // they were hashed to `stamps`. Returns false otherwise, leaving `out` and `deps` untouched.
+    bool read_ast_file(const acul::path &path, Parser &out, IOInfo &deps, uint64_t salt, FileProvider &files,
+                       acul::vector<uint64_t> *stamps = nullptr);
+} // namespace ahtt
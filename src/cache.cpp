@@ -0,0 +1,182 @@
+#include "cache.hpp"
+#include <algorithm>
+#include "ast_file.hpp"
+#include "disk_cache.hpp"
+#include "linker.hpp"
+
+namespace ahtt
+{
+    void clone_parser(const Parser &src, Parser &dst)
+    {
+        dst.ast.clear();
+        dst.arena.clear();
+
+        // Only the nodes the replace map and extends point at need their copies looked up.
+        NodeMap map;
+        map.reserve(2 * (src.replace_map.blocks.size() + src.replace_map.includes.size()) + 1);
+        auto want = [&map](const ReplaceSlot &slot) {
+            map.emplace_back(slot.node, nullptr);
+            if (slot.parent) map.emplace_back(slot.parent, nullptr);
+        };
+        for (const auto &slot : src.replace_map.blocks) want(slot);
+        for (const auto &slot : src.replace_map.includes) want(slot);
+        if (src.extends) map.emplace_back(src.extends, nullptr);
+        std::sort(map.begin(), map.end());
+        map.erase(std::unique(map.begin(), map.end()), map.end());
+
+        clone_nodes(src.ast, dst.ast, dst.arena, &map);
+
+        auto copy_of = [&map](const INode *node) -> INode * {
+            if (!node) return nullptr;
+            auto it = std::lower_bound(map.begin(), map.end(), std::make_pair(node, static_cast<INode *>(nullptr)));
+            return it->second;
+        };
+        auto remap = [&copy_of](const ReplaceSlot &slot) {
+            return ReplaceSlot{copy_of(slot.node), copy_of(slot.parent), slot.offset};
+        };
+        dst.replace_map.ids = src.replace_map.ids;
+        dst.replace_map.blocks.clear();
+        for (const auto &slot : src.replace_map.blocks) dst.replace_map.blocks.push_back(remap(slot));
+        dst.replace_map.includes.clear();
+        for (const auto &slot : src.replace_map.includes) dst.replace_map.includes.push_back(remap(slot));
+        dst.extends = static_cast<ExtendsNode *>(copy_of(src.extends));
+    }
+
+    static acul::string cache_key(const acul::path &path, const acul::path &base_path)
+    {
+        acul::string key = file_key(path);
+        key += '|';
+        key += base_path.str();
+        return key;
+    }
+
+    bool ParseCache::is_fresh(const Entry &entry, FileProvider &files)
+    {
+        for (size_t i = 0; i < entry.deps.size(); ++i)
+            if (files.stamp(entry.deps[i].path) != entry.stamps[i]) return false;
+        return true;
+    }
+
+    void ParseCache::load(const acul::path &path, const acul::path &base_path, Parser &out, IOInfo &io,
+                          FileProvider &files)
+    {
+        load_entry(path, base_path, out, io, files, false);
+    }
+
+    void ParseCache::load_layout(const acul::path &path, const acul::path &base_path, Parser &out, IOInfo &io,
+                                 FileProvider &files)
+    {
+        load_entry(path, base_path, out, io, files, true);
+    }
+
+    void ParseCache::load_entry(const acul::path &path, const acul::path &base_path, Parser &out, IOInfo &io,
+                                FileProvider &files, bool layout)
+    {
+        ProfileScope scope(layout ? "layout_cache" : "parse_cache", &path);
+        acul::string key = cache_key(path, base_path);
+        if (layout) key += "|layout";
+        std::shared_ptr<const Entry> entry;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            auto it = _entries.find(key);
+            if (it != _entries.end()) entry = it->second;
+        }
+
+        if (!entry || !is_fresh(*entry, files))
+        {
+            auto fresh = std::make_shared<Entry>();
+            acul::path ast_path;
+            uint64_t salt = 0;
+            bool mapped = false;
+            if (_ast_files)
+            {
+                ast_path = acul::path(path.str() + (layout ? ".layout.atb" : ".atb"));
+                salt = fnv1a(base_path.str().data(), base_path.str().size(), _ast_salt);
+                mapped = read_ast_file(ast_path, fresh->parser, fresh->deps, salt, files, &fresh->stamps);
+            }
+
+            if (!mapped)
+            {
+                // Stamp the input before reading it so that an edit during the parse invalidates the entry.
+                fresh->stamps.push_back(files.stamp(path));
+                if (layout)
+                {
+                    // Every layout further up the chain comes from its own entry.
+                    load(path, base_path, fresh->parser, fresh->deps, files);
+                    extend_layout(fresh->parser, base_path, fresh->deps, files, this);
+                }
+                else
+                {
+                    parse_file(path, fresh->parser, fresh->deps, files);
+                    resolve_includes(fresh->parser, base_path, fresh->deps, files, this);
+                }
+                for (size_t i = fresh->stamps.size(); i < fresh->deps.size(); ++i)
+                    fresh->stamps.push_back(files.stamp(fresh->deps[i].path));
+                if (_ast_files && !write_ast_file(ast_path, fresh->parser, fresh->deps, salt))
+                    LOG_WARN("Failed to write %s", ast_path.str().c_str());
+            }
+            entry = fresh;
+
+            std::lock_guard<std::mutex> lock(_mutex);
+            _entries[key] = entry;
+        }
+        else
+            LOG_INFO("Using cached %s: %s", layout ? "layout" : "template", path.str().c_str());
+
+        clone_parser(entry->parser, out);
+        // The copy still points into the sources held by the entry.
+        out.arena.retain(entry);
+        if (scope.active()) scope.nodes = count_nodes(out.ast);
+        io.insert(io.end(), entry->deps.begin(), entry->deps.end());
+    }
+
+    void ParseCache::parse_file(const acul::path &path, Parser &out, IOInfo &io, FileProvider &files)
+    {
+        if (!_incremental)
+        {
+            load_template(path, out, io, files);
+            return;
+        }
+
+        std::shared_ptr<FileParse> file;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            auto &slot = _files[file_key(path)];
+            if (!slot) slot = std::make_shared<FileParse>();
+            file = slot;
+        }
+
+        std::lock_guard<std::mutex> lock(file->mutex);
+        uint64_t stamp = files.stamp(path);
+        if (stamp == 0 || stamp != file->stamp)
+        {
+            LOG_INFO("Loading template file: %s", path.str().c_str());
+            ProfileScope scope("reparse", &path);
+            SourceRef source = files.open(path);
+            if (!source)
+                throw acul::runtime_error(acul::format("Failed to read template file: %s", path.str().c_str()));
+            scope.bytes = file->parse.update(source);
+            file->stamp = stamp;
+        }
+        else
+            LOG_INFO("Using parsed template: %s", path.str().c_str());
+
+        const Parser &tree = file->parse.tree();
+        clone_parser(tree, out);
+        for (const auto &arena : file->parse.arenas()) out.arena.retain(arena);
+        io.emplace_back(path, file->parse.size(), file->parse.source());
+    }
+
+    void ParseCache::set_ast_files(const acul::string &salt)
+    {
+        _ast_files = true;
+        _ast_salt = fnv1a(salt.data(), salt.size());
+    }
+
+    void ParseCache::clear()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _entries.clear();
+        _files.clear();
+    }
+} // namespace ahtt
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include "files.hpp"
+#include "parser.hpp"
+#include "reparse.hpp"
+
+namespace ahtt
+{
+    // Deep-copies the AST of `src` into `dst` and rebinds replace slots and extends to the copy. Node
+    // strings are not copied, so the sources of `src` must outlive `dst`.
+    void clone_parser(const Parser &src, Parser &dst);
+
+    // Cache of include-resolved templates keyed by normalized path. Entries are revalidated against
+    // the provider stamp of every file they were built from. Use one cache per file provider.
+    class ParseCache
+    {
+    public:
+        // An incremental cache also keeps the parse of every file read through parse_file(), so that an edited
+        // file is only re-parsed around the edit. Meant for processes that outlive edits, e.g. --watch.
+        explicit ParseCache(bool incremental = false) : _incremental(incremental) {}
+
+        // load_template() through the cache: fills `out` with a private copy of the parse of `path`.
+        void parse_file(const acul::path &path, Parser &out, IOInfo &io, FileProvider &files);
+
+        // Fills `out` with a private copy of the template at `path` with its includes resolved and
+        // appends every file it was built from to `io`.
+        void load(const acul::path &path, const acul::path &base_path, Parser &out, IOInfo &io,
+                  FileProvider &files);
+
+        // Like load(), but for the skeleton of a layout with its own extends chain merged in (see load_layout()).
+        void load_layout(const acul::path &path, const acul::path &base_path, Parser &out, IOInfo &io,
+                         FileProvider &files);
+
+        // Also keeps every entry in a binary file next to its source (<file>.atb, <file>.layout.atb) and maps
+        // such a file instead of parsing when its inputs are unchanged, which lets separate processes share
+        // parses. `salt` must capture everything besides the inputs that changes a parse, as for DiskCache.
+        void set_ast_files(const acul::string &salt);
+
+        void clear();
+
+    private:
+        struct Entry
+        {
+            Parser parser;
+            IOInfo deps;
+            acul::vector<uint64_t> stamps;
+        };
+
+        struct FileParse
+        {
+            std::mutex mutex;
+            uint64_t stamp = 0;
+            IncrementalParse parse;
+        };
+
+        bool _incremental;
+        bool _ast_files = false;
+        uint64_t _ast_salt = 0;
+        std::mutex _mutex;
+        acul::hashmap<acul::string, std::shared_ptr<const Entry>> _entries;
+        acul::hashmap<acul::string, std::shared_ptr<FileParse>> _files;
+
+        static bool is_fresh(const Entry &entry, FileProvider &files);
+
+        void load_entry(const acul::path &path, const acul::path &base_path, Parser &out, IOInfo &io,
+                        FileProvider &files, bool layout);
+    };
+} // namespace ahtt
@@ -0,0 +1,105 @@
+#include "disk_cache.hpp"
+#include "file_utils.hpp"
+#include <acul/io/fs/file.hpp>
+#include <acul/log.hpp>
+#include <filesystem>
+
+#define AHTT_DISK_CACHE_MAGIC "ahtt-cache-v1"
+
+namespace ahtt
+{
+    static std::filesystem::path to_fs(const acul::path &p) { return std::filesystem::path(p.str().c_str()); }
+
+    DiskCache::DiskCache(const acul::path &dir, const acul::string &salt) : _dir(dir), _salt(salt)
+    {
+        std::error_code ec;
+        std::filesystem::create_directories(to_fs(dir), ec);
+        if (ec) throw acul::runtime_error(acul::format("Failed to create cache directory: %s", dir.str().c_str()));
+    }
+
+    acul::string DiskCache::entry_name(const acul::path &input, const acul::path &base_dir) const
+    {
+        std::error_code ec;
+        auto abs_input = std::filesystem::absolute(to_fs(input), ec).string();
+        auto abs_base = std::filesystem::absolute(to_fs(base_dir), ec).string();
+        uint64_t h = fnv1a(abs_input.data(), abs_input.size());
+        h = fnv1a("\0", 1, h);
+        h = fnv1a(abs_base.data(), abs_base.size(), h);
+        h = fnv1a("\0", 1, h);
+        h = fnv1a(_salt.data(), _salt.size(), h);
+        return acul::format("%016llx", static_cast<unsigned long long>(h));
+    }
+
+    bool DiskCache::restore(const acul::path &input, const acul::path &base_dir, const acul::string &output,
+                            IOInfo &io)
+    {
+        auto name = entry_name(input, base_dir);
+        auto manifest_path = _dir / (name + ".dep");
+        acul::vector<char> manifest;
+        if (!acul::fs::read_binary(manifest_path.str(), manifest)) return false;
+
+        acul::string_view_pool<char> pool;
+        acul::fill_line_buffer(manifest.data(), manifest.size(), pool);
+
+        IOInfo deps;
+        acul::vector<char> buffer;
+        bool is_header = true;
+        for (const auto ln : pool)
+        {
+            acul::string line(ln.data(), ln.size());
+            if (is_header)
+            {
+                if (line != AHTT_DISK_CACHE_MAGIC) return false;
+                is_header = false;
+                continue;
+            }
+            if (line.empty()) continue;
+
+            // "<hash> <size> <path>"
+            char *end = nullptr;
+            uint64_t hash = strtoull(line.c_str(), &end, 16);
+            size_t size = strtoull(end, &end, 10);
+            if (!end || *end != ' ') return false;
+            acul::path path(acul::string(end + 1));
+
+            if (!acul::fs::read_binary(path.str(), buffer) || buffer.size() != size) return false;
+            if (fnv1a(buffer.data(), buffer.size()) != hash) return false;
+            deps.emplace_back(path, size);
+        }
+        if (deps.empty()) return false;
+
+        if (!acul::fs::read_binary((_dir / (name + ".hpp")).str(), buffer)) return false;
+        if (!write_if_changed(output, buffer.data(), buffer.size())) return false;
+
+        LOG_INFO("Cache hit for %s", input.str().c_str());
+        io.insert(io.end(), deps.begin(), deps.end());
+        return true;
+    }
+
+    void DiskCache::store(const acul::path &input, const acul::path &base_dir, const IOInfo &io, const char *data,
+                          size_t size)
+    {
+        auto name = entry_name(input, base_dir);
+        acul::stringstream ss;
+        ss << AHTT_DISK_CACHE_MAGIC "\n";
+        // Hash the bytes that were parsed: files reread here may already hold a later edit.
+        for (const auto &dep : io)
+        {
+            if (!dep.source) return;
+            const auto &source = dep.source;
+            ss << acul::format("%016llx %zu ", static_cast<unsigned long long>(fnv1a(source->data(), source->size())),
+                               source->size())
+               << dep.path.str() << '\n';
+        }
+
+        // The header goes first so that a readable manifest always has its header in place.
+        if (!write_atomic((_dir / (name + ".hpp")).str(), data, size))
+        {
+            LOG_WARN("Failed to store %s in the cache", input.str().c_str());
+            return;
+        }
+        auto manifest = ss.str();
+        if (!write_atomic((_dir / (name + ".dep")).str(), manifest.data(), manifest.size()))
+            LOG_WARN("Failed to store %s in the cache", input.str().c_str());
+    }
+} // namespace ahtt
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "parser.hpp"
+
+namespace ahtt
+{
+    inline uint64_t fnv1a(const void *data, size_t size, uint64_t h = 0xcbf29ce484222325ull)
+    {
+        auto *p = static_cast<const unsigned char *>(data);
+        for (size_t i = 0; i < size; ++i)
+        {
+            h ^= p[i];
+            h *= 0x100000001b3ull;
+        }
+        return h;
+    }
+
+    // Persistent transpile cache. Each entry stores the generated header together with the content
+    // hash of every file it was built from; a hit costs one hash pass over those files.
+    class DiskCache
+    {
+    public:
+        // `salt` must capture everything besides the inputs that changes the generated code.
+        DiskCache(const acul::path &dir, const acul::string &salt);
+
+        // On a hit writes `output`, appends the recorded inputs to `io` and returns true.
+        bool restore(const acul::path &input, const acul::path &base_dir, const acul::string &output, IOInfo &io);
+
+        // Records the sources `io` carries, so nothing is stored if an input has none.
+        void store(const acul::path &input, const acul::path &base_dir, const IOInfo &io, const char *data,
+                   size_t size);
+
+    private:
+        acul::path _dir;
+        acul::string _salt;
+
+        acul::string entry_name(const acul::path &input, const acul::path &base_dir) const;
+    };
+} // namespace ahtt
@@ -0,0 +1,135 @@
+#include "driver.hpp"
+#include <algorithm>
+#include <atomic>
+#include "cache.hpp"
+#include "disk_cache.hpp"
+#include "file_utils.hpp"
+#include "profiler.hpp"
+#include "worker_pool.hpp"
+
+namespace ahtt
+{
+    static void write_output(const acul::string &path, const char *data, size_t size)
+    {
+        bool written;
+        if (!write_if_changed(path, data, size, &written))
+            throw acul::runtime_error(acul::format("Failed to write file: %s", path.c_str()));
+        if (!written) LOG_INFO("Up to date: %s", path.c_str());
+    }
+
+    static void write_dep_file(const Job &job, const IOInfo &io)
+    {
+        LOG_INFO("Writing dependency file: %s", job.dep_file.c_str());
+
+        // Load order depends on how includes are spliced; sort so the file only changes with the deps.
+        acul::vector<acul::string> deps;
+        deps.reserve(io.size());
+        for (size_t i = 1; i < io.size(); ++i) deps.push_back(io[i].path.str());
+        std::sort(deps.begin(), deps.end());
+        deps.erase(std::unique(deps.begin(), deps.end()), deps.end());
+
+        acul::stringstream ss_dep;
+        ss_dep << job.output << ": \\\n";
+        if (!io.empty()) ss_dep << "    " << io.front().path.str();
+        for (const auto &dep : deps)
+            if (dep != io.front().path.str()) ss_dep << " \\\n    " << dep;
+        auto dep_content = ss_dep.str();
+        write_output(job.dep_file, dep_content.data(), dep_content.size());
+    }
+
+    void transpile(const Job &job, const Session &session, IOInfo &io)
+    {
+        ProfileScope scope("transpile", &job.input);
+        if (session.disk_cache && session.disk_cache->restore(job.input, session.base_dir, job.output, io))
+        {
+            if (!job.dep_file.empty()) write_dep_file(job, io);
+            return;
+        }
+
+        LOG_INFO("Translating template: %s", job.input.str().c_str());
+        FileProvider &files = session.files ? *session.files : disk_files();
+        Result result =
+            transpile(Request{job.input, session.base_dir, {}}, files, session.parse_cache, session.pool);
+        io.insert(io.end(), result.deps.begin(), result.deps.end());
+        LOG_INFO("Writing to %s", job.output.c_str());
+
+        const auto &file_content = result.code;
+        write_output(job.output, file_content.data(), file_content.size());
+        scope.bytes = file_content.size();
+
+        if (!job.dep_file.empty()) write_dep_file(job, io);
+        if (session.disk_cache)
+            session.disk_cache->store(job.input, session.base_dir, io, file_content.data(), file_content.size());
+    }
+
+    static inline bool is_space(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+    void load_manifest(const acul::path &path, acul::vector<Job> &jobs)
+    {
+        acul::vector<char> buffer;
+        if (!acul::fs::read_binary(path.str(), buffer))
+            throw acul::runtime_error(acul::format("Failed to read manifest: %s", path.str().c_str()));
+
+        acul::string_view_pool<char> pool;
+        pool.reserve(buffer.size() / 32);
+        acul::fill_line_buffer(buffer.data(), buffer.size(), pool);
+
+        int line_no = 0;
+        for (const auto ln : pool)
+        {
+            ++line_no;
+            acul::vector<acul::string_view> fields;
+            const char *p = ln.data();
+            const char *end = p + ln.size();
+            while (p < end)
+            {
+                while (p < end && is_space(*p)) ++p;
+                if (p == end) break;
+                const char *beg = p;
+                while (p < end && !is_space(*p)) ++p;
+                fields.emplace_back(beg, static_cast<size_t>(p - beg));
+            }
+            if (fields.empty() || fields.front().front() == '#') continue;
+            if (fields.size() < 2 || fields.size() > 3)
+                throw acul::runtime_error(
+                    acul::format("Invalid manifest entry at %s:%d", path.str().c_str(), line_no));
+
+            Job job;
+            job.input = acul::string(fields[0]);
+            job.output = acul::string(fields[1]);
+            if (fields.size() == 3) job.dep_file = acul::string(fields[2]);
+            jobs.push_back(std::move(job));
+        }
+    }
+
+    size_t run_batch(const acul::vector<Job> &jobs, const Session &session, size_t threads,
+                     acul::vector<IOInfo> *deps)
+    {
+        if (threads > jobs.size()) threads = jobs.size();
+        LOG_INFO("Batch: %zu templates on %zu workers", jobs.size(), threads);
+        if (deps) deps->resize(jobs.size());
+
+        std::atomic<size_t> failed{0};
+        WorkerPool pool(threads);
+        Session pool_session = session;
+        pool_session.pool = &pool;
+        for (size_t i = 0; i < jobs.size(); ++i)
+        {
+            pool.submit([&jobs, i, &pool_session, &failed, deps] {
+                IOInfo io;
+                try
+                {
+                    transpile(jobs[i], pool_session, io);
+                }
+                catch (const std::exception &e)
+                {
+                    LOG_ERROR("%s: %s", jobs[i].input.str().c_str(), e.what());
+                    failed.fetch_add(1, std::memory_order_relaxed);
+                }
+                if (deps) (*deps)[i] = std::move(io);
+            });
+        }
+        pool.wait();
+        return failed.load();
+    }
+} // namespace ahtt
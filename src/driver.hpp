@@ -0,0 +1,38 @@
+#pragma once
+
+#include "ahtt.hpp"
+
+namespace ahtt
+{
+    struct Job
+    {
+        acul::path input;
+        acul::string output;
+        acul::string dep_file;
+    };
+
+    class DiskCache;
+    class WorkerPool;
+
+    // State shared by every template transpiled in one run.
+    struct Session
+    {
+        acul::path base_dir;
+        ParseCache *parse_cache = nullptr;
+        DiskCache *disk_cache = nullptr;
+        FileProvider *files = nullptr; // disk when null
+        WorkerPool *pool = nullptr;    // reads includes ahead when set
+    };
+
+    // Runs the whole pipeline for a single template and writes its header and dependency file.
+    void transpile(const Job &job, const Session &session, IOInfo &io);
+
+    // Manifest format: one job per line, "<input> <output> [dep-file]". Blank lines and lines
+    // starting with '#' are ignored.
+    void load_manifest(const acul::path &path, acul::vector<Job> &jobs);
+
+    // Transpiles all jobs on a pool of `threads` workers. Returns the number of failed jobs.
+    // When `deps` is given it receives the files each job was built from, in job order.
+    size_t run_batch(const acul::vector<Job> &jobs, const Session &session, size_t threads,
+                     acul::vector<IOInfo> *deps = nullptr);
+} // namespace ahtt
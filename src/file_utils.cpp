@@ -0,0 +1,49 @@
+#include "file_utils.hpp"
+#include <acul/io/fs/file.hpp>
+#include <acul/string/utils.hpp>
+#include <cstring>
+#include <filesystem>
+#include <random>
+#include <thread>
+
+namespace ahtt
+{
+    static bool has_content(const acul::string &path, const char *data, size_t size)
+    {
+        std::error_code ec;
+        auto existing_size = std::filesystem::file_size(std::filesystem::path(path.c_str()), ec);
+        if (ec || existing_size != size) return false;
+
+        acul::vector<char> existing;
+        if (!acul::fs::read_binary(path, existing) || existing.size() != size) return false;
+        return size == 0 || memcmp(existing.data(), data, size) == 0;
+    }
+
+    bool write_if_changed(const acul::string &path, const char *data, size_t size, bool *written)
+    {
+        if (written) *written = false;
+        if (has_content(path, data, size)) return true;
+        if (!acul::fs::write_binary(path, data, size)) return false;
+        if (written) *written = true;
+        return true;
+    }
+
+    bool write_atomic(const acul::string &path, const char *data, size_t size)
+    {
+        std::filesystem::path target(path.c_str());
+        auto tmp = target;
+        tmp += acul::format(".%zx%08x.tmp", std::hash<std::thread::id>{}(std::this_thread::get_id()),
+                            std::random_device{}())
+                   .c_str();
+        if (!acul::fs::write_binary(acul::string(tmp.string().c_str()), data, size)) return false;
+        std::error_code ec;
+        std::filesystem::rename(tmp, target, ec);
+        if (ec)
+        {
+            std::error_code rm;
+            std::filesystem::remove(tmp, rm);
+            return false;
+        }
+        return true;
+    }
+} // namespace ahtt
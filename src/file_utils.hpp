@@ -0,0 +1,13 @@
+#pragma once
+
+#include <acul/string/string.hpp>
+
+namespace ahtt
+{
+    // Writes the file only when its current content differs, so unchanged outputs keep their mtime.
+    // Returns false on I/O failure.
+    bool write_if_changed(const acul::string &path, const char *data, size_t size, bool *written = nullptr);
+
+    // Writes a temporary file and renames it over `path`, so readers never see a partial file.
+    bool write_atomic(const acul::string &path, const char *data, size_t size);
+} // namespace ahtt
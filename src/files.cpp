@@ -0,0 +1,146 @@
+#include "files.hpp"
+#include <acul/io/fs/file.hpp>
+#include <filesystem>
+#ifndef _WIN32
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+namespace ahtt
+{
+    class BufferSource final : public Source
+    {
+    public:
+        explicit BufferSource(acul::vector<char> &&buffer) : _buffer(std::move(buffer))
+        {
+            _data = _buffer.data();
+            _size = _buffer.size();
+        }
+
+        explicit BufferSource(acul::string &&text) : _text(std::move(text))
+        {
+            _data = _text.data();
+            _size = _text.size();
+        }
+
+    private:
+        acul::vector<char> _buffer;
+        acul::string _text;
+    };
+
+#ifndef _WIN32
+    class MappedSource final : public Source
+    {
+    public:
+        MappedSource(void *addr, size_t size)
+        {
+            _data = static_cast<const char *>(addr);
+            _size = size;
+        }
+
+        ~MappedSource() override { munmap(const_cast<char *>(_data), _size); }
+    };
+
+    // Null when the file cannot be mapped; the caller falls back to reading it.
+    static SourceRef map_file(const acul::path &path)
+    {
+        int fd = ::open(path.str().c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return nullptr;
+        struct stat st;
+        SourceRef source;
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+        {
+            size_t size = static_cast<size_t>(st.st_size);
+            void *addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (addr != MAP_FAILED) source = std::make_shared<MappedSource>(addr, size);
+        }
+        ::close(fd);
+        return source;
+    }
+#endif
+
+    SourceRef FileProvider::open(const acul::path &path)
+    {
+        acul::vector<char> buffer;
+        if (!read(path, buffer)) return nullptr;
+        return std::make_shared<BufferSource>(std::move(buffer));
+    }
+
+    acul::string file_key(const acul::path &path)
+    {
+        return acul::string(std::filesystem::path(path.str().c_str()).lexically_normal().string().c_str());
+    }
+
+    bool DiskFileProvider::read(const acul::path &path, acul::vector<char> &buffer)
+    {
+        return acul::fs::read_binary(path.str(), buffer);
+    }
+
+    SourceRef DiskFileProvider::open(const acul::path &path)
+    {
+#ifndef _WIN32
+        if (_map_files)
+            if (auto source = map_file(path)) return source;
+#endif
+        return FileProvider::open(path);
+    }
+
+    uint64_t DiskFileProvider::stamp(const acul::path &path)
+    {
+        std::filesystem::path p(path.str().c_str());
+        std::error_code ec;
+        auto size = std::filesystem::file_size(p, ec);
+        if (ec) return 0;
+        auto mtime = std::filesystem::last_write_time(p, ec);
+        if (ec) return 0;
+        uint64_t h = static_cast<uint64_t>(mtime.time_since_epoch().count());
+        h ^= static_cast<uint64_t>(size) + 0x9e3779b97f4a7c15ull + (h << 6) + (h >> 2);
+        return h ? h : 1;
+    }
+
+    void MemoryFileProvider::set(const acul::path &path, acul::string content)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto &file = _files[file_key(path)];
+        file.content = std::make_shared<BufferSource>(std::move(content));
+        file.stamp = _next_stamp++;
+    }
+
+    bool MemoryFileProvider::remove(const acul::path &path)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _files.erase(file_key(path)) != 0;
+    }
+
+    bool MemoryFileProvider::read(const acul::path &path, acul::vector<char> &buffer)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto it = _files.find(file_key(path));
+        if (it == _files.end()) return false;
+        const auto &content = *it->second.content;
+        buffer.assign(content.data(), content.data() + content.size());
+        return true;
+    }
+
+    SourceRef MemoryFileProvider::open(const acul::path &path)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto it = _files.find(file_key(path));
+        return it == _files.end() ? nullptr : it->second.content;
+    }
+
+    uint64_t MemoryFileProvider::stamp(const acul::path &path)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto it = _files.find(file_key(path));
+        return it == _files.end() ? 0 : it->second.stamp;
+    }
+
+    FileProvider &disk_files()
+    {
+        static DiskFileProvider provider;
+        return provider;
+    }
+} // namespace ahtt
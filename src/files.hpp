@@ -0,0 +1,85 @@
+#pragma once
+
+#include <acul/hash/hashmap.hpp>
+#include <acul/io/path.hpp>
+#include <acul/string/string.hpp>
+#include <acul/vector.hpp>
+#include <memory>
+#include <mutex>
+
+namespace ahtt
+{
+    // Immutable contents of one file. AST strings are views into it, so parsers keep it referenced.
+    class Source
+    {
+    public:
+        virtual ~Source() = default;
+
+        const char *data() const { return _data; }
+        size_t size() const { return _size; }
+
+    protected:
+        const char *_data = nullptr;
+        size_t _size = 0;
+    };
+
+    using SourceRef = std::shared_ptr<const Source>;
+
+    // Source of templates, layouts and includes. Implementations must be thread-safe.
+    class FileProvider
+    {
+    public:
+        virtual ~FileProvider() = default;
+
+        virtual bool read(const acul::path &path, acul::vector<char> &buffer) = 0;
+
+        // Null when the file is missing. The default implementation copies the file through read().
+        virtual SourceRef open(const acul::path &path);
+
+        // Version of the file; any change to the content must change the stamp. 0 when the file is missing.
+        virtual uint64_t stamp(const acul::path &path) = 0;
+    };
+
+    class DiskFileProvider final : public FileProvider
+    {
+    public:
+        // Mapped files must not be truncated while referenced, so long-running processes that keep
+        // parsed templates between edits should read them instead.
+        explicit DiskFileProvider(bool map_files = true) : _map_files(map_files) {}
+
+        bool read(const acul::path &path, acul::vector<char> &buffer) override;
+        SourceRef open(const acul::path &path) override;
+        uint64_t stamp(const acul::path &path) override;
+
+    private:
+        bool _map_files;
+    };
+
+    // Keeps sources in memory, e.g. editor buffers or generated templates.
+    class MemoryFileProvider final : public FileProvider
+    {
+    public:
+        void set(const acul::path &path, acul::string content);
+        bool remove(const acul::path &path);
+
+        bool read(const acul::path &path, acul::vector<char> &buffer) override;
+        SourceRef open(const acul::path &path) override;
+        uint64_t stamp(const acul::path &path) override;
+
+    private:
+        struct File
+        {
+            SourceRef content;
+            uint64_t stamp;
+        };
+
+        std::mutex _mutex;
+        acul::hashmap<acul::string, File> _files;
+        uint64_t _next_stamp = 1;
+    };
+
+    FileProvider &disk_files();
+
+    // Lexically normalized path used as the identity of a file.
+    acul::string file_key(const acul::path &path);
+} // namespace ahtt
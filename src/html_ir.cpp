@@ -1,6 +1,7 @@
 #include "html_ir.hpp"
 #include <acul/lut_table.hpp>
 #include "parser.hpp"
+#include "scanner.hpp"
 
 namespace ahtt
 {
@@ -50,211 +51,86 @@ namespace ahtt
         if (!s.empty()) v.push_back({HtmlSegment::Expr, s});
     }
 
-    static HtmlValue parse_segments_interp(acul::string_view val)
+    // Splits `val` into literals and "#{...}" expressions.
+    static HtmlValue parse_segments_interp(acul::string_view val, const StructuralIndex &idx)
     {
         HtmlValue out;
-        const char *p = val.data();
-        const char *e = p + val.size();
-        const char *lit_begin = p;
+        const char *e = val.data() + val.size();
+        const char *lit_begin = val.data();
 
-        while (p < e)
+        for (const uint32_t *it = idx.seek(val.data());; ++it)
         {
-            if (p + 1 < e && p[0] == '#' && p[1] == '{')
+            const char *s = idx.at(it);
+            if (s + 1 >= e) break;
+            if (*s != '#') continue;
+
+            push_lit(out.segs, {lit_begin, size_t(s - lit_begin)});
+            const char *close = idx.match_interp(s + 2, e);
+            push_expr(out.segs, {s + 2, size_t(close - (s + 2))});
+            if (close == e)
             {
-                if (p > lit_begin) push_lit(out.segs, {lit_begin, size_t(p - lit_begin)});
-                p += 2;
-                const char *expr_begin = p;
-                int depth = 1;
-                bool in_s = false, in_d = false;
-                while (p < e && depth > 0)
-                {
-                    char c = *p++;
-                    if (!in_s && !in_d)
-                    {
-                        if (c == '{')
-                            ++depth;
-                        else if (c == '}')
-                            --depth;
-                        else if (c == '\'')
-                            in_s = true;
-                        else if (c == '"')
-                            in_d = true;
-                    }
-                    else if (in_s)
-                    {
-                        if (c == '\\' && p < e)
-                            ++p;
-                        else if (c == '\'')
-                            in_s = false;
-                    }
-                    else
-                    {
-                        if (c == '\\' && p < e)
-                            ++p;
-                        else if (c == '"')
-                            in_d = false;
-                    }
-                }
-                const char *expr_end = (depth == 0) ? (p - 1) : p;
-                push_expr(out.segs, {expr_begin, size_t(expr_end - expr_begin)});
-                lit_begin = p;
+                lit_begin = e;
+                break;
             }
-            else { ++p; }
+            lit_begin = close + 1;
+            it = idx.seek(close);
         }
-        if (p > lit_begin) push_lit(out.segs, {lit_begin, size_t(p - lit_begin)});
+        push_lit(out.segs, {lit_begin, size_t(e - lit_begin)});
         return out;
     }
 
-    static HtmlSegment read_gettext_expr_segment(const char *&pos, const char *end)
+    // `p` points at "_("; returns the whole call including the closing ')'.
+    static acul::string_view read_gettext_call(const char *&p, const char *end, const StructuralIndex &idx)
     {
-        const char *beg = pos;
-        if (!(pos + 1 < end && pos[0] == '_' && pos[1] == '(')) return {HtmlSegment::Literal, {beg, 0}};
-        pos += 2;
-        int paren = 1;
-        bool in_s = false, in_d = false, in_interp = false;
-        int brace = 0;
-        while (pos < end && paren > 0)
-        {
-            char c = *pos++;
-            if (in_interp)
-            {
-                if (!in_s && !in_d)
-                {
-                    if (c == '{')
-                        ++brace;
-                    else if (c == '}')
-                    {
-                        if (--brace == 0) in_interp = false;
-                    }
-                    else if (c == '\'')
-                        in_s = true;
-                    else if (c == '"')
-                        in_d = true;
-                }
-                else if (in_s)
-                {
-                    if (c == '\\' && pos < end)
-                        ++pos;
-                    else if (c == '\'')
-                        in_s = false;
-                }
-                else
-                {
-                    if (c == '\\' && pos < end)
-                        ++pos;
-                    else if (c == '"')
-                        in_d = false;
-                }
-                continue;
-            }
-            if (!in_s && !in_d)
-            {
-                if (c == '(')
-                    ++paren;
-                else if (c == ')')
-                    --paren;
-                else if (c == '#' && pos < end && *pos == '{')
-                {
-                    ++pos;
-                    in_interp = true;
-                    brace = 1;
-                }
-                else if (c == '\'')
-                    in_s = true;
-                else if (c == '"')
-                    in_d = true;
-            }
-            else
-            {
-                if (c == '\\' && pos < end)
-                {
-                    ++pos;
-                    continue;
-                }
-                if (in_s && c == '\'')
-                    in_s = false;
-                else if (in_d && c == '"')
-                    in_d = false;
-            }
-        }
-        return {HtmlSegment::Expr, {beg, size_t(pos - beg)}};
+        const char *call_beg = p;
+        const char *close = idx.match_gettext(p + 2, end);
+        p = close == end ? end : close + 1;
+        return {call_beg, size_t(p - call_beg)};
     }
 
-    HtmlValue parse_segments_full(acul::string_view val)
+    // Splits `val` into literals, "#{...}" expressions and "_(...)" calls.
+    static HtmlValue parse_segments(acul::string_view val, const StructuralIndex &idx)
     {
         HtmlValue out;
-        const char *p = val.data();
-        const char *e = p + val.size();
-        const char *lit_begin = p;
+        const char *e = val.data() + val.size();
+        const char *lit_begin = val.data();
 
-        auto flush_lit = [&](const char *up_to) {
-            if (up_to > lit_begin) push_lit(out.segs, {lit_begin, size_t(up_to - lit_begin)});
-            lit_begin = up_to;
-        };
-
-        while (p < e)
+        for (const uint32_t *it = idx.seek(val.data());; ++it)
         {
-            // #{...}
-            if (p + 1 < e && p[0] == '#' && p[1] == '{')
+            const char *s = idx.at(it);
+            if (s + 1 >= e) break;
+            if (*s == '#')
             {
-                flush_lit(p);
-                p += 2; // skip #{
-                const char *expr_begin = p;
-                int depth = 1;
-                bool in_s = false, in_d = false;
-                while (p < e && depth > 0)
+                push_lit(out.segs, {lit_begin, size_t(s - lit_begin)});
+                const char *close = idx.match_interp(s + 2, e);
+                push_expr(out.segs, {s + 2, size_t(close - (s + 2))});
+                if (close == e)
                 {
-                    char c = *p++;
-                    if (!in_s && !in_d)
-                    {
-                        if (c == '{')
-                            ++depth;
-                        else if (c == '}')
-                            --depth;
-                        else if (c == '\'')
-                            in_s = true;
-                        else if (c == '"')
-                            in_d = true;
-                    }
-                    else if (in_s)
-                    {
-                        if (c == '\\' && p < e)
-                            ++p;
-                        else if (c == '\'')
-                            in_s = false;
-                    }
-                    else
-                    {
-                        if (c == '\\' && p < e)
-                            ++p;
-                        else if (c == '"')
-                            in_d = false;
-                    }
+                    lit_begin = e;
+                    break;
                 }
-                const char *expr_end = (depth == 0) ? (p - 1) : p;
-                push_expr(out.segs, {expr_begin, size_t(expr_end - expr_begin)});
-                lit_begin = p;
-                continue;
+                lit_begin = close + 1;
+                it = idx.seek(close);
             }
-
-            // _( ... )
-            if (p + 1 < e && p[0] == '_' && p[1] == '(')
+            else if (*s == '_')
             {
-                flush_lit(p);
-                const char *tmp = p;
-                HtmlSegment seg = read_gettext_expr_segment(tmp, e);
-                push_expr(out.segs, seg.sv);
-                p = lit_begin = tmp;
-                continue;
+                push_lit(out.segs, {lit_begin, size_t(s - lit_begin)});
+                lit_begin = s;
+                push_expr(out.segs, read_gettext_call(lit_begin, e, idx));
+                if (lit_begin == e) break;
+                it = idx.seek(lit_begin - 1);
             }
-
-            ++p;
         }
-
-        if (p > lit_begin) push_lit(out.segs, {lit_begin, size_t(p - lit_begin)});
+        push_lit(out.segs, {lit_begin, size_t(e - lit_begin)});
         return out;
     }
 
+    HtmlValue parse_segments_full(acul::string_view val, StructuralIndex &scan)
+    {
+        scan.build(val);
+        return parse_segments(val, scan);
+    }
+
     inline HtmlValue parse_html_value(const char *&pos, const char *begin, const char *end)
     {
         while (pos < end)
@@ -290,94 +166,20 @@ namespace ahtt
         return {beg, size_t(p - beg)};
     }
 
-    static acul::string_view read_quoted(const char *&p, const char *end)
+    // Returns the text between the quote at `p` and its closing quote. An unclosed value keeps the old
+    // behaviour of treating the last byte as the closing quote.
+    static acul::string_view read_quoted(const char *&p, const char *end, const StructuralIndex &idx)
     {
         char q = *p++;
         const char *beg = p;
-        while (p < end)
-        {
-            char c = *p++;
-            if (c == '\\' && p < end)
-            {
-                ++p;
-                continue;
-            }
-            if (c == q) break;
-        }
-        return {beg, size_t((p - 1) - beg)};
-    }
-
-    static acul::string_view read_gettext_call(const char *&p, const char *end)
-    {
-        const char *call_beg = p;
-        if (!(p + 1 < end && p[0] == '_' && p[1] == '(')) return {};
-        p += 2;
-        int paren = 1;
-        bool in_s = false, in_d = false, in_interp = false;
-        int brace = 0;
-
-        while (p < end && paren > 0)
+        const char *close = idx.match_quote(p, end, q);
+        if (close != end)
         {
-            char c = *p++;
-            if (in_interp)
-            {
-                if (!in_s && !in_d)
-                {
-                    if (c == '{')
-                        ++brace;
-                    else if (c == '}')
-                    {
-                        if (--brace == 0) in_interp = false;
-                    }
-                    else if (c == '\'')
-                        in_s = true;
-                    else if (c == '"')
-                        in_d = true;
-                }
-                else if (in_s)
-                {
-                    if (c == '\\' && p < end) { ++p; }
-                    else if (c == '\'')
-                        in_s = false;
-                }
-                else
-                {
-                    if (c == '\\' && p < end) { ++p; }
-                    else if (c == '"')
-                        in_d = false;
-                }
-                continue;
-            }
-
-            if (!in_s && !in_d)
-            {
-                if (c == '(') { ++paren; }
-                else if (c == ')') { --paren; }
-                else if (c == '#' && p < end && *p == '{')
-                {
-                    ++p;
-                    in_interp = true;
-                    brace = 1;
-                }
-                else if (c == '\'')
-                    in_s = true;
-                else if (c == '"')
-                    in_d = true;
-            }
-            else
-            {
-                if (c == '\\' && p < end)
-                {
-                    ++p;
-                    continue;
-                }
-                if (in_s && c == '\'')
-                    in_s = false;
-                else if (in_d && c == '"')
-                    in_d = false;
-            }
+            p = close + 1;
+            return {beg, size_t(close - beg)};
         }
-        return {call_beg, size_t(p - call_beg)};
+        p = end;
+        return {beg, beg < end ? size_t(end - 1 - beg) : 0};
     }
 
     static acul::string_view read_unquoted(const char *&p, const char *end)
@@ -392,10 +194,9 @@ namespace ahtt
         return {beg, size_t(p - beg)};
     }
 
-    void parse_html_attr(const char *&pos, const char *begin, const char *end, acul::vector<HtmlAttr> &attrs)
+    static void parse_html_attr(const char *&pos, const char *end, acul::vector<HtmlAttr> &attrs,
+                                const StructuralIndex &idx)
     {
-        (void)begin;
-
         while (pos < end)
         {
             skip_ws(pos, end);
@@ -446,14 +247,14 @@ namespace ahtt
             if (pos < end && (*pos == '"' || *pos == '\''))
             {
                 const char *q_open = pos;
-                auto inner = read_quoted(pos, end);
+                auto inner = read_quoted(pos, end, idx);
                 const char *q_close = pos - 1;
 
-                if (inner.find("#{") == acul::string_view::npos && inner.find("_(") == acul::string_view::npos)
+                if (!idx.has_expr(inner.data(), inner.data() + inner.size()))
                     val = hv_lit(acul::string_view(q_open, static_cast<size_t>(q_close - q_open + 1)));
                 else
                 {
-                    HtmlValue inner_val = parse_segments_full(inner);
+                    HtmlValue inner_val = parse_segments(inner, idx);
                     if (!inner_val.has_expr())
                         val = hv_lit(acul::string_view(q_open, static_cast<size_t>(q_close - q_open + 1)));
                     else
@@ -466,13 +267,13 @@ namespace ahtt
             }
             else if (pos + 1 < end && pos[0] == '_' && pos[1] == '(')
             {
-                auto call = read_gettext_call(pos, end);
+                auto call = read_gettext_call(pos, end, idx);
                 val = hv_expr(call);
             }
             else
             {
                 auto uv = read_unquoted(pos, end);
-                val = parse_segments_full(uv);
+                val = parse_segments(uv, idx);
             }
 
             attr.value = std::move(val);
@@ -480,45 +281,15 @@ namespace ahtt
         }
     }
 
-    static acul::string_view read_head_token(const char *&p, const char *end)
+    static acul::string_view read_head_token(const char *&p, const char *end, const StructuralIndex &idx)
     {
         const char *beg = p;
         while (p < end)
         {
             if ((p + 1 < end) && p[0] == '#' && p[1] == '{')
             {
-                p += 2;
-                int depth = 1;
-                bool in_s = false, in_d = false;
-                while (p < end && depth > 0)
-                {
-                    char d = *p++;
-                    if (!in_s && !in_d)
-                    {
-                        if (d == '{')
-                            ++depth;
-                        else if (d == '}')
-                            --depth;
-                        else if (d == '\'')
-                            in_s = true;
-                        else if (d == '"')
-                            in_d = true;
-                    }
-                    else if (in_s)
-                    {
-                        if (d == '\\' && p < end)
-                            ++p;
-                        else if (d == '\'')
-                            in_s = false;
-                    }
-                    else // in_d
-                    {
-                        if (d == '\\' && p < end)
-                            ++p;
-                        else if (d == '"')
-                            in_d = false;
-                    }
-                }
+                const char *close = idx.match_interp(p + 2, end);
+                p = close == end ? end : close + 1;
                 continue;
             }
 
@@ -530,7 +301,7 @@ namespace ahtt
         return {beg, size_t(p - beg)};
     }
 
-    void parse_to_html_ir(HTMLNode *node, HtmlIR &ir, const char *&pos)
+    static void parse_ir(HTMLNode *node, HtmlIR &ir, const char *&pos, const StructuralIndex &idx)
     {
         const char *head_begin = node->head.data();
         const char *head_end = head_begin + node->head.size();
@@ -550,8 +321,8 @@ namespace ahtt
                     {
                         ++pos;
                         if (ir.tag.empty()) ir.tag = "div";
-                        acul::string_view tok = read_head_token(pos, head_end);
-                        ir.classes.push_back(parse_segments_interp(tok));
+                        acul::string_view tok = read_head_token(pos, head_end, idx);
+                        ir.classes.push_back(parse_segments_interp(tok, idx));
                         continue;
                     }
                     case '#':
@@ -561,8 +332,8 @@ namespace ahtt
                         if (!ir.id.empty())
                             throw acul::runtime_error(
                                 acul::format("ID must be unique. At line %d, col %d", node->pos.line, node->pos.col));
-                        acul::string_view tok = read_head_token(pos, head_end);
-                        ir.id = parse_segments_interp(tok);
+                        acul::string_view tok = read_head_token(pos, head_end, idx);
+                        ir.id = parse_segments_interp(tok, idx);
                         continue;
                     }
                     case '{':
@@ -574,7 +345,7 @@ namespace ahtt
                     case '(':
                     {
                         ++pos;
-                        parse_html_attr(pos, pos, head_end, ir.attrs);
+                        parse_html_attr(pos, head_end, ir.attrs, idx);
                         if (pos < head_end && *pos == ')') ++pos;
                         continue;
                     }
@@ -584,7 +355,7 @@ namespace ahtt
                         ir.next = acul::make_unique<HtmlIR>();
                         ++pos;
                         while (pos < head_end && std::isspace(static_cast<unsigned char>(*pos))) ++pos;
-                        parse_to_html_ir(node, *ir.next, pos);
+                        parse_ir(node, *ir.next, pos, idx);
                         return;
                     }
 
@@ -597,7 +368,7 @@ namespace ahtt
                             while (pos < head_end && is_ws(*pos)) ++pos;
 
                         acul::string_view sv(pos, static_cast<size_t>(head_end - pos));
-                        ir.content = is_expr ? hv_expr(sv) : parse_segments_full(sv);
+                        ir.content = is_expr ? hv_expr(sv) : parse_segments(sv, idx);
                         return;
                     }
                 }
@@ -609,4 +380,10 @@ namespace ahtt
         if (ir.tag.empty()) ir.tag = acul::string_view(begin, static_cast<size_t>(head_end - begin));
     }
 
+    void parse_to_html_ir(HTMLNode *node, HtmlIR &ir, const char *&pos, StructuralIndex &scan)
+    {
+        scan.build(node->head);
+        parse_ir(node, ir, pos, scan);
+    }
+
 } // namespace ahtt
\ No newline at end of file
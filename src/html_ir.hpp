@@ -44,7 +44,10 @@ namespace ahtt
         acul::unique_ptr<HtmlIR> next;
     };
 
-    void parse_to_html_ir(struct HTMLNode *node, HtmlIR &ir, const char *&pos);
+    class StructuralIndex;
 
-    HtmlValue parse_segments_full(acul::string_view val);
+    // Both rebuild `scan` for the text they parse; it is only passed in so its buffer can be reused.
+    void parse_to_html_ir(struct HTMLNode *node, HtmlIR &ir, const char *&pos, StructuralIndex &scan);
+
+    HtmlValue parse_segments_full(acul::string_view val, StructuralIndex &scan);
 } // namespace ahtt
\ No newline at end of file
@@ -0,0 +1,176 @@
+#include "parser.hpp"
+#include "simd.hpp"
+
+namespace ahtt
+{
+    namespace
+    {
+        // Kernels report the length of the leading space run and the position of the next '\n'.
+        struct ScalarKernel
+        {
+            static inline size_t count_spaces(const char *p, const char *end)
+            {
+                const char *start = p;
+                while (p < end && *p == ' ') ++p;
+                return static_cast<size_t>(p - start);
+            }
+
+            static inline const char *find_newline(const char *p, const char *end)
+            {
+                while (p < end && *p != '\n') ++p;
+                return p;
+            }
+        };
+
+#if AHTT_SIMD_X86
+        struct SSE2Kernel
+        {
+            static inline size_t count_spaces(const char *p, const char *end)
+            {
+                const char *start = p;
+                const __m128i space = _mm_set1_epi8(' ');
+                while (end - p >= 16)
+                {
+                    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+                    unsigned mask = ~static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, space))) & 0xFFFFu;
+                    if (mask) return static_cast<size_t>(p - start) + simd::ctz32(mask);
+                    p += 16;
+                }
+                return static_cast<size_t>(p - start) + ScalarKernel::count_spaces(p, end);
+            }
+
+            static inline const char *find_newline(const char *p, const char *end)
+            {
+                const __m128i nl = _mm_set1_epi8('\n');
+                while (end - p >= 16)
+                {
+                    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+                    unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, nl)));
+                    if (mask) return p + simd::ctz32(mask);
+                    p += 16;
+                }
+                return ScalarKernel::find_newline(p, end);
+            }
+        };
+
+        struct AVX2Kernel
+        {
+            AHTT_TARGET_AVX2 static inline size_t count_spaces(const char *p, const char *end)
+            {
+                const char *start = p;
+                const __m256i space = _mm256_set1_epi8(' ');
+                while (end - p >= 32)
+                {
+                    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+                    unsigned mask = ~static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, space)));
+                    if (mask) return static_cast<size_t>(p - start) + simd::ctz32(mask);
+                    p += 32;
+                }
+                return static_cast<size_t>(p - start) + SSE2Kernel::count_spaces(p, end);
+            }
+
+            AHTT_TARGET_AVX2 static inline const char *find_newline(const char *p, const char *end)
+            {
+                const __m256i nl = _mm256_set1_epi8('\n');
+                while (end - p >= 32)
+                {
+                    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+                    unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nl)));
+                    if (mask) return p + simd::ctz32(mask);
+                    p += 32;
+                }
+                return SSE2Kernel::find_newline(p, end);
+            }
+        };
+#endif
+    } // namespace
+
+    // Splits lines and measures indentation in one pass over the buffer; a trailing '\r' is dropped.
+    template <class Kernel>
+    AHTT_ALWAYS_INLINE static void lex_lines(const char *data, size_t size, int first_line, acul::vector<Tok> &out)
+    {
+        out.reserve(size / 16 + 2);
+        acul::vector<int> stack{0};
+        int line_no = first_line;
+
+        const char *p = data;
+        const char *end = data + size;
+        while (p < end)
+        {
+            int sp = static_cast<int>(Kernel::count_spaces(p, end));
+            const char *content = p + sp;
+            const char *eol = Kernel::find_newline(content, end);
+            const char *content_end = eol;
+            if (content_end > content && content_end[-1] == '\r') --content_end;
+
+            size_t content_len = static_cast<size_t>(content_end - content);
+            if (content_len == 0)
+                out.push_back({Tok::blank, {}, {line_no, 1}, (int)stack.size() - 1});
+            else
+            {
+                while (sp < stack.back())
+                {
+                    stack.pop_back();
+                    out.push_back({Tok::dedent, {}, {line_no, 1}, (int)stack.size() - 1});
+                }
+
+                if (sp > stack.back())
+                {
+                    stack.push_back(sp);
+                    out.push_back({Tok::indent, {}, {line_no, 1}, (int)stack.size() - 1});
+                }
+
+                out.push_back(
+                    {Tok::line, acul::string_view(content, content_len), {line_no, sp + 1}, (int)stack.size() - 1});
+            }
+
+            ++line_no;
+            if (eol == end) break;
+            p = eol + 1;
+        }
+
+        while (stack.size() > 1)
+        {
+            stack.pop_back();
+            out.push_back({Tok::dedent, {}, {line_no, 1}, (int)stack.size() - 1});
+        }
+
+        out.push_back({Tok::eof, {}, {line_no, 1}, 0});
+    }
+
+#if AHTT_SIMD_X86
+    AHTT_TARGET_AVX2 static void lex_avx2(const char *data, size_t size, int first_line, acul::vector<Tok> &out)
+    {
+        lex_lines<AVX2Kernel>(data, size, first_line, out);
+    }
+
+    static void lex_sse2(const char *data, size_t size, int first_line, acul::vector<Tok> &out)
+    {
+        lex_lines<SSE2Kernel>(data, size, first_line, out);
+    }
+#else
+    static void lex_scalar(const char *data, size_t size, int first_line, acul::vector<Tok> &out)
+    {
+        lex_lines<ScalarKernel>(data, size, first_line, out);
+    }
+#endif
+
+    using LexFn = void (*)(const char *, size_t, int, acul::vector<Tok> &);
+
+    static LexFn select_lexer()
+    {
+#if AHTT_SIMD_X86
+        return simd::has_avx2() ? lex_avx2 : lex_sse2;
+#else
+        return lex_scalar;
+#endif
+    }
+
+    acul::vector<Tok> lex_with_indents(const char *data, size_t size, int first_line)
+    {
+        static const LexFn lex = select_lexer();
+        acul::vector<Tok> out;
+        lex(data, size, first_line, out);
+        return out;
+    }
+} // namespace ahtt
@@ -1,186 +1,559 @@
 #include "linker.hpp"
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include "cache.hpp"
+#include "worker_pool.hpp"
 
 namespace ahtt
 {
-    void resolve_includes(Parser &p, const acul::path &base_path, IOInfo &io);
-
-    void append_plain_text(const ReplaceSlot &slot, const acul::path &path, Parser &p, Pos pos, size_t offset,
-                           IOInfo &io)
+    namespace
     {
-        LOG_INFO("Loading file: %s", path.str().c_str());
-        acul::vector<char> file_buffer;
-        if (acul::fs::read_binary(path.str(), file_buffer))
-            throw acul::runtime_error(acul::format("Failed to read file: %s", path.str().c_str()));
-        io.emplace_back(path, file_buffer.size());
+        enum class LoadKind
+        {
+            text,
+            at,
+            layout
+        };
 
-        auto text_node = acul::make_unique<TextNode>();
-        text_node->text = acul::string(file_buffer.data(), file_buffer.size());
-        text_node->pos = pos;
-        if (!slot.parent)
-            p.ast[slot.offset + offset] = std::move(text_node);
+        // Reads and parses the includes and the layout of one link on a worker pool while the caller splices.
+        // Loads are keyed by path and handed out in the caller's order, so the result does not depend on which
+        // one finished first. A load the caller needs before a worker picked it up runs on the caller's thread,
+        // which keeps a link running on a worker of the same pool from waiting on itself.
+        class IncludePrefetch
+        {
+        public:
+            IncludePrefetch(WorkerPool &pool, FileProvider &files, const acul::path &base_path, ParseCache *cache)
+                : _state(std::make_shared<State>(pool, files, base_path, cache))
+            {
+            }
+
+            // Queued loads are dropped; running ones are waited for, as they use the caller's provider and cache.
+            ~IncludePrefetch() { _state->cancel(); }
+
+            void queue(const acul::path &path, LoadKind kind) { _state->queue(path, kind); }
+
+            void queue_includes(const Parser &p) { _state->queue_includes(p); }
+
+            // Moves the template loaded from `path` into `out` and appends the files it was built from to
+            // `io`. Returns false if it was not queued, failed or was handed out already; the caller then
+            // loads it itself, which also reports any error the same way as without prefetching.
+            bool take(const acul::path &path, LoadKind kind, Parser &out, IOInfo &io)
+            {
+                return _state->take(path, kind, out, io);
+            }
+
+            SourceRef take_text(const acul::path &path) { return _state->take_text(path); }
+
+        private:
+            struct Load
+            {
+                acul::path path;
+                LoadKind kind;
+                enum
+                {
+                    queued,
+                    running,
+                    done,
+                    taken
+                } state = queued;
+                bool failed = false;
+                Parser parser;
+                IOInfo io;
+                SourceRef source;
+            };
+
+            // Shared with the queued tasks, which may outlive the prefetch.
+            class State : public std::enable_shared_from_this<State>
+            {
+            public:
+                State(WorkerPool &pool, FileProvider &files, const acul::path &base_path, ParseCache *cache)
+                    : _pool(pool), _files(files), _base_path(base_path), _cache(cache)
+                {
+                }
+
+                void queue(const acul::path &path, LoadKind kind)
+                {
+                    std::shared_ptr<Load> load;
+                    {
+                        std::lock_guard<std::mutex> lock(_mutex);
+                        auto &slot = _loads[path.str()];
+                        if (slot || _cancelled) return;
+                        slot = load = std::make_shared<Load>();
+                        load->path = path;
+                        load->kind = kind;
+                    }
+                    // Ahead of queued jobs: the link that asked for the load needs it before they do.
+                    _pool.submit_priority([self = shared_from_this(), load] {
+                        if (self->claim(*load)) self->run(*load);
+                    });
+                }
+
+                void queue_includes(const Parser &p)
+                {
+                    for (const auto &slot : p.replace_map.includes)
+                    {
+                        auto *node = static_cast<const IncludeNode *>(slot.node);
+                        queue(_base_path / node->path,
+                              node->mode == IncludeNode::Mode::plain ? LoadKind::text : LoadKind::at);
+                    }
+                }
+
+                bool take(const acul::path &path, LoadKind kind, Parser &out, IOInfo &io)
+                {
+                    auto load = find(path);
+                    if (!load || load->kind != kind) return false;
+                    finish(*load);
+                    {
+                        std::lock_guard<std::mutex> lock(_mutex);
+                        if (load->state != Load::done || load->failed) return false;
+                        load->state = Load::taken;
+                    }
+                    out = std::move(load->parser);
+                    io.insert(io.end(), load->io.begin(), load->io.end());
+                    return true;
+                }
+
+                SourceRef take_text(const acul::path &path)
+                {
+                    auto load = find(path);
+                    if (!load || load->kind != LoadKind::text) return nullptr;
+                    finish(*load);
+                    return load->source;
+                }
+
+                void cancel()
+                {
+                    std::unique_lock<std::mutex> lock(_mutex);
+                    _cancelled = true;
+                    _cv.wait(lock, [this] { return _running == 0; });
+                }
+
+            private:
+                WorkerPool &_pool;
+                FileProvider &_files;
+                acul::path _base_path;
+                ParseCache *_cache;
+                std::mutex _mutex;
+                std::condition_variable _cv;
+                acul::hashmap<acul::string, std::shared_ptr<Load>> _loads;
+                size_t _running = 0;
+                bool _cancelled = false;
+
+                std::shared_ptr<Load> find(const acul::path &path)
+                {
+                    std::lock_guard<std::mutex> lock(_mutex);
+                    auto it = _loads.find(path.str());
+                    return it == _loads.end() ? nullptr : it->second;
+                }
+
+                bool claim(Load &load)
+                {
+                    std::lock_guard<std::mutex> lock(_mutex);
+                    if (load.state != Load::queued || _cancelled) return false;
+                    load.state = Load::running;
+                    ++_running;
+                    return true;
+                }
+
+                void run(Load &load)
+                {
+                    try
+                    {
+                        if (load.kind == LoadKind::text)
+                            load.source = _files.open(load.path);
+                        else if (load.kind == LoadKind::layout)
+                            load_layout(load.path, _base_path, load.parser, load.io, _files, _cache);
+                        else if (_cache)
+                            _cache->load(load.path, _base_path, load.parser, load.io, _files);
+                        else
+                        {
+                            load_template(load.path, load.parser, load.io, _files);
+                            queue_includes(load.parser);
+                        }
+                    }
+                    catch (const std::exception &)
+                    {
+                        load.failed = true;
+                    }
+                    std::lock_guard<std::mutex> lock(_mutex);
+                    if (load.kind == LoadKind::text && !load.source) load.failed = true;
+                    load.state = Load::done;
+                    --_running;
+                    _cv.notify_all();
+                }
+
+                // Runs `load` here if no worker has started it yet, otherwise waits for it.
+                void finish(Load &load)
+                {
+                    if (claim(load))
+                    {
+                        run(load);
+                        return;
+                    }
+                    std::unique_lock<std::mutex> lock(_mutex);
+                    _cv.wait(lock, [&load] { return load.state != Load::running; });
+                }
+            };
+
+            std::shared_ptr<State> _state;
+        };
+    } // namespace
+
+    static void resolve_slots(Parser &p, const acul::path &base_path, IOInfo &io, FileProvider &files,
+                              ParseCache *cache, IncludePrefetch *prefetch);
+
+    static void load_linked(const acul::path &path, const acul::path &base_path, Parser &p, IOInfo &io,
+                            FileProvider &files, ParseCache *cache, IncludePrefetch *prefetch = nullptr)
+    {
+        if (prefetch && prefetch->take(path, LoadKind::at, p, io))
+        {
+            if (!cache) resolve_slots(p, base_path, io, files, nullptr, prefetch);
+        }
+        else if (cache)
+            cache->load(path, base_path, p, io, files);
         else
         {
-            auto *parent = dynamic_cast<ParentNode *>(slot.parent);
-            if (!parent) throw acul::runtime_error("Invalid parent node");
-            parent->children[slot.offset + offset] = std::move(text_node);
+            load_template(path, p, io, files);
+            resolve_slots(p, base_path, io, files, nullptr, prefetch);
         }
     }
 
-    inline void append_template(const ReplaceSlot &slot, Parser &p, const acul::path &base_path, const acul::path &path,
-                                ptrdiff_t &delta, IOInfo &io)
+    namespace
     {
-        Parser inc;
-        load_template(path, inc, io);
-        resolve_includes(inc, base_path, io);
+        // Nodes [first, last) of a shared buffer that take the place of the slot at `offset` of a children list.
+        struct Splice
+        {
+            size_t offset;
+            size_t first, last;
+        };
 
-        const size_t N = inc.ast.size();
+        struct BlockGroup
+        {
+            INode *parent;
+            size_t first, last;
+            bool done = false;
+        };
 
-        auto &vec = (!slot.parent) ? p.ast : dynamic_cast<ParentNode *>(slot.parent)->children;
+        // Layout block slots grouped by parent, in (parent, offset) order.
+        struct BlockContext
+        {
+            Parser &layout;
+            Parser &child;
+            // Overridden blocks are replaced by merged blocks instead of their nodes, so they can be filled again.
+            bool open;
+            acul::vector<ReplaceSlot *> slots;
+            acul::vector<BlockGroup> groups;
+            // Group of the slots directly inside a block that is itself replaced.
+            acul::hashmap<const INode *, size_t> nested;
+        };
+    } // namespace
 
-        const ptrdiff_t pos_signed = static_cast<ptrdiff_t>(slot.offset) + delta;
-        if (pos_signed < 0 || static_cast<size_t>(pos_signed) >= vec.size())
-            throw acul::runtime_error("include replacement position out of range");
-        const size_t pos = static_cast<size_t>(pos_signed);
+    static bool by_position(const ReplaceSlot *a, const ReplaceSlot *b)
+    {
+        return a->parent < b->parent || (a->parent == b->parent && a->offset < b->offset);
+    }
 
-        if (N == 0)
+    static NodeList &children_of(Parser &p, INode *parent)
+    {
+        if (!parent) return p.ast;
+        if (!is_parent_kind(parent->kind())) throw acul::runtime_error("Invalid parent node");
+        return static_cast<ParentNode *>(parent)->children;
+    }
+
+    // Rebuilds `vec` in one pass with the nodes of every splice in place of its slot. `splices` and `keep` are
+    // sorted by offset; `keep` are slots of the same list that stay in it and get their rebuilt offsets.
+    static void splice_list(NodeList &vec, const acul::vector<Splice> &splices, const NodeList &nodes,
+                            ReplaceSlot *const *keep = nullptr, ReplaceSlot *const *keep_end = nullptr)
+    {
+        size_t size = vec.size();
+        for (const auto &splice : splices) size += splice.last - splice.first - 1;
+
+        NodeList out;
+        out.reserve(size);
+        size_t i = 0;
+        for (const auto &splice : splices)
         {
-            vec.erase(vec.begin() + pos);
-            delta -= 1;
-            return;
+            if (splice.offset >= vec.size()) throw acul::runtime_error("replacement position out of range");
+            for (; keep != keep_end && (*keep)->offset < splice.offset; ++keep)
+                (*keep)->offset = out.size() + ((*keep)->offset - i);
+            out.insert(out.end(), vec.begin() + i, vec.begin() + splice.offset);
+            out.insert(out.end(), nodes.begin() + splice.first, nodes.begin() + splice.last);
+            i = splice.offset + 1;
         }
+        for (; keep != keep_end; ++keep) (*keep)->offset = out.size() + ((*keep)->offset - i);
+        out.insert(out.end(), vec.begin() + i, vec.end());
+        vec = std::move(out);
+    }
 
-        vec.insert(vec.begin() + pos, std::make_move_iterator(inc.ast.begin()), std::make_move_iterator(inc.ast.end()));
-        vec.erase(vec.begin() + (pos + N));
-        delta += static_cast<ptrdiff_t>(N) - 1;
+    static TextNode *load_plain_text(const acul::path &path, Parser &p, Pos pos, IOInfo &io, FileProvider &files,
+                                     IncludePrefetch *prefetch)
+    {
+        LOG_INFO("Loading file: %s", path.str().c_str());
+        SourceRef source = prefetch ? prefetch->take_text(path) : nullptr;
+        if (!source) source = files.open(path);
+        if (!source) throw acul::runtime_error(acul::format("Failed to read file: %s", path.str().c_str()));
+        io.emplace_back(path, source->size(), source);
+        p.arena.retain(source);
+
+        auto *text_node = p.arena.make<TextNode>();
+        text_node->text = acul::string_view(source->data(), source->size());
+        text_node->pos = pos;
+        return text_node;
+    }
+
+    static void load_included(Parser &p, const acul::path &base_path, const acul::path &path, IOInfo &io,
+                              FileProvider &files, ParseCache *cache, IncludePrefetch *prefetch, NodeList &out)
+    {
+        Parser inc;
+        load_linked(path, base_path, inc, io, files, cache, prefetch);
+        p.arena.adopt(std::move(inc.arena));
+        out.insert(out.end(), inc.ast.begin(), inc.ast.end());
     }
 
-    void resolve_includes(Parser &p, const acul::path &base_path, IOInfo &io)
+    static void resolve_slots(Parser &p, const acul::path &base_path, IOInfo &io, FileProvider &files,
+                              ParseCache *cache, IncludePrefetch *prefetch)
     {
-        acul::vector<acul::pair<acul::string, ReplaceSlot>> to_replace{p.replace_map.begin(), p.replace_map.end()};
-        std::sort(to_replace.begin(), to_replace.end(), [](const auto &a, const auto &b) {
-            const auto &slot_a = a.second;
-            const auto &slot_b = b.second;
-            return slot_a.parent < slot_b.parent || (slot_a.parent == slot_b.parent && slot_a.offset < slot_b.offset);
-        });
+        ProfileScope scope("resolve_includes");
+        auto &map = p.replace_map;
+        if (map.includes.empty()) return;
+        if (prefetch) prefetch->queue_includes(p);
 
-        ptrdiff_t added_offset = 0;
-        INode *prev_parent = nullptr;
-        acul::vector<acul::string> erased;
-        for (const auto &[name, slot] : to_replace)
+        // Blocks share the children lists of includes, so they are walked along to keep their offsets valid.
+        acul::vector<ReplaceSlot *> slots;
+        slots.reserve(map.includes.size() + map.blocks.size());
+        for (auto &slot : map.includes) slots.push_back(&slot);
+        for (auto &slot : map.blocks) slots.push_back(&slot);
+        std::sort(slots.begin(), slots.end(), by_position);
+
+        acul::vector<Splice> splices;
+        acul::vector<ReplaceSlot *> keep;
+        NodeList nodes;
+        for (size_t i = 0; i < slots.size();)
         {
-            if (prev_parent != slot.parent) added_offset = 0;
-            if (slot.node->kind() == INode::Kind::include)
+            INode *parent = slots[i]->parent;
+            NodeList &vec = children_of(p, parent);
+            splices.clear();
+            keep.clear();
+            nodes.clear();
+            for (; i < slots.size() && slots[i]->parent == parent; ++i)
             {
-                erased.push_back(name);
-                auto *node = static_cast<IncludeNode *>(slot.node);
+                ReplaceSlot *slot = slots[i];
+                if (slot->node->kind() != INode::Kind::include)
+                {
+                    keep.push_back(slot);
+                    continue;
+                }
+                ++scope.nodes;
+                if (slot->offset >= vec.size())
+                    throw acul::runtime_error("include replacement position out of range");
+                assert(vec[slot->offset] == slot->node);
+
+                auto *node = static_cast<IncludeNode *>(slot->node);
                 auto path = base_path / node->path;
                 if (node->mode == IncludeNode::Mode::plain)
-                    append_plain_text(slot, path, p, node->pos, added_offset, io);
+                    vec[slot->offset] = load_plain_text(path, p, node->pos, io, files, prefetch);
                 else
-                    append_template(slot, p, base_path, path, added_offset, io);
+                {
+                    size_t first = nodes.size();
+                    load_included(p, base_path, path, io, files, cache, prefetch, nodes);
+                    splices.push_back({slot->offset, first, nodes.size()});
+                }
             }
-            else
-                p.replace_map[name].offset += added_offset;
-            prev_parent = slot.parent;
+            if (!splices.empty()) splice_list(vec, splices, nodes, keep.data(), keep.data() + keep.size());
         }
-        for (const auto &name : erased) p.replace_map.erase(name);
+        map.includes.clear();
     }
 
-    void resolve_blocks(Parser &layout, Parser &child_parser)
+    void resolve_includes(Parser &p, const acul::path &base_path, IOInfo &io, FileProvider &files, ParseCache *cache)
     {
-        acul::vector<acul::pair<acul::string, ReplaceSlot>> to_replace;
-        to_replace.reserve(layout.replace_map.size());
-        for (const auto &kv : layout.replace_map)
-            if (kv.second.node->kind() == INode::Kind::block) to_replace.push_back(kv);
+        resolve_slots(p, base_path, io, files, cache, nullptr);
+    }
 
-        std::sort(to_replace.begin(), to_replace.end(), [](const auto &a, const auto &b) {
-            const auto &sa = a.second, &sb = b.second;
-            return sa.parent < sb.parent || (sa.parent == sb.parent && sa.offset < sb.offset);
-        });
+    // Appends the nodes that take the place of the layout block `orig_block` to `nodes`. Returns false if the
+    // child does not override it.
+    static bool fill_block(BlockContext &ctx, const BlockNode *orig_block, NodeList &nodes)
+    {
+        const NodeList &orig = orig_block->children;
+        uint32_t id = ctx.child.replace_map.find(orig_block->name);
+        if (id == ReplaceMap::npos)
+        {
+            nodes.insert(nodes.end(), orig.begin(), orig.end());
+            return false;
+        }
 
-        ptrdiff_t added_offset = 0;
-        INode *prev_parent = nullptr;
+        const auto &child_slot = ctx.child.replace_map.blocks[id];
+        assert(child_slot.node->kind() == INode::Kind::block);
+        auto *child_block = static_cast<BlockNode *>(child_slot.node);
+        const NodeList &over = child_block->children;
 
-        for (const auto &[name, slot] : to_replace)
+        switch (child_block->mode)
         {
-            if (prev_parent != slot.parent) added_offset = 0;
-
-            auto &vec = (!slot.parent) ? layout.ast : static_cast<ParentNode *>(slot.parent)->children;
+            case BlockNode::Mode::replace:
+                nodes.insert(nodes.end(), over.begin(), over.end());
+                break;
+            case BlockNode::Mode::prepend:
+                nodes.insert(nodes.end(), over.begin(), over.end());
+                nodes.insert(nodes.end(), orig.begin(), orig.end());
+                break;
+            case BlockNode::Mode::append:
+                nodes.insert(nodes.end(), orig.begin(), orig.end());
+                nodes.insert(nodes.end(), over.begin(), over.end());
+                break;
+            default:
+                throw acul::runtime_error("unknown BlockNode mode");
+        }
+        return true;
+    }
 
-            const ptrdiff_t pos_signed = static_cast<ptrdiff_t>(slot.offset) + added_offset;
-            if (pos_signed < 0 || static_cast<size_t>(pos_signed) >= vec.size())
+    static void splice_blocks(BlockContext &ctx, BlockGroup &group)
+    {
+        group.done = true;
+        NodeList &vec = children_of(ctx.layout, group.parent);
+        for (size_t i = group.first; i < group.last; ++i)
+            if (ctx.slots[i]->offset >= vec.size() || vec[ctx.slots[i]->offset] != ctx.slots[i]->node)
                 throw acul::runtime_error("block replacement position out of range");
-            const size_t pos = static_cast<size_t>(pos_signed);
 
-            assert(vec[pos].get() == slot.node);
-            auto *orig_block = static_cast<BlockNode *>(slot.node);
+        acul::vector<Splice> splices;
+        splices.reserve(group.last - group.first);
+        NodeList nodes;
+        for (size_t i = group.first; i < group.last; ++i)
+        {
+            const ReplaceSlot *slot = ctx.slots[i];
+            auto *orig_block = static_cast<BlockNode *>(slot->node);
 
-            auto it = child_parser.replace_map.find(name);
-            NodeList final_children;
+            // A block directly inside this one must be in place before its children are taken.
+            auto nested = ctx.nested.find(orig_block);
+            if (nested != ctx.nested.end() && !ctx.groups[nested->second].done)
+                splice_blocks(ctx, ctx.groups[nested->second]);
 
-            if (it == child_parser.replace_map.end()) { final_children = std::move(orig_block->children); }
-            else
+            if (ctx.open)
             {
-                const auto &child_slot = it->second;
-                assert(child_slot.node->kind() == INode::Kind::block);
-                auto *child_block = static_cast<BlockNode *>(child_slot.node);
-
-                switch (child_block->mode)
-                {
-                    case BlockNode::Mode::replace:
-                    {
-                        final_children = std::move(child_block->children);
-                        break;
-                    }
-                    case BlockNode::Mode::prepend:
-                    {
-                        final_children.reserve(child_block->children.size() + orig_block->children.size());
-                        for (auto &n : child_block->children) final_children.push_back(std::move(n));
-                        for (auto &n : orig_block->children) final_children.push_back(std::move(n));
-                        break;
-                    }
-                    case BlockNode::Mode::append:
-                    {
-                        final_children.reserve(child_block->children.size() + orig_block->children.size());
-                        for (auto &n : orig_block->children) final_children.push_back(std::move(n));
-                        for (auto &n : child_block->children) final_children.push_back(std::move(n));
-                        break;
-                    }
-                    default:
-                        throw acul::runtime_error("unknown BlockNode mode");
-                }
+                // One block takes the place of another, so no offset in the list moves.
+                NodeList merged;
+                if (!fill_block(ctx, orig_block, merged)) continue;
+                auto *block = ctx.layout.arena.make<BlockNode>();
+                block->name = orig_block->name;
+                block->pos = orig_block->pos;
+                block->children = std::move(merged);
+                vec[slot->offset] = block;
+                continue;
             }
 
-            const size_t N = final_children.size();
+            size_t first = nodes.size();
+            fill_block(ctx, orig_block, nodes);
+            splices.push_back({slot->offset, first, nodes.size()});
+        }
+        if (!splices.empty()) splice_list(vec, splices, nodes);
+    }
 
-            if (N == 0)
+    // Registers every named block below `parent` in document order, the order the parser adds them in.
+    static void collect_blocks(ReplaceMap &map, INode *parent, NodeList &list)
+    {
+        for (size_t i = 0; i < list.size(); ++i)
+        {
+            INode *node = list[i];
+            if (!node) continue;
+            if (node->kind() == INode::Kind::block)
             {
-                vec.erase(vec.begin() + pos);
-                added_offset -= 1;
+                auto *block = static_cast<BlockNode *>(node);
+                if (!block->name.empty()) map.add_block(block->name, {block, parent, i});
             }
-            else
+            if (is_parent_kind(node->kind())) collect_blocks(map, node, static_cast<ParentNode *>(node)->children);
+        }
+    }
+
+    static void merge_blocks(Parser &layout, Parser &child_parser, bool open)
+    {
+        ProfileScope scope("resolve_blocks");
+        BlockContext ctx{layout, child_parser, open, {}, {}, {}};
+        ctx.slots.reserve(layout.replace_map.blocks.size());
+        for (auto &slot : layout.replace_map.blocks) ctx.slots.push_back(&slot);
+        scope.nodes = ctx.slots.size();
+        std::sort(ctx.slots.begin(), ctx.slots.end(), by_position);
+
+        for (size_t i = 0; i < ctx.slots.size();)
+        {
+            BlockGroup group{ctx.slots[i]->parent, i, i};
+            while (group.last < ctx.slots.size() && ctx.slots[group.last]->parent == group.parent) ++group.last;
+            if (group.parent && group.parent->kind() == INode::Kind::block)
+                ctx.nested.emplace(group.parent, ctx.groups.size());
+            ctx.groups.push_back(group);
+            i = group.last;
+        }
+        for (auto &group : ctx.groups)
+            if (!group.done) splice_blocks(ctx, group);
+    }
+
+    void resolve_blocks(Parser &layout, Parser &child_parser) { merge_blocks(layout, child_parser, false); }
+
+    namespace
+    {
+        // Layouts being loaded on this thread, so an extends cycle is reported instead of recursing forever.
+        thread_local acul::vector<acul::string> t_layout_chain;
+
+        struct LayoutChainGuard
+        {
+            explicit LayoutChainGuard(const acul::path &path)
             {
-                vec.insert(vec.begin() + pos, std::make_move_iterator(final_children.begin()),
-                           std::make_move_iterator(final_children.end()));
-                vec.erase(vec.begin() + (pos + N));
-                added_offset += static_cast<ptrdiff_t>(N) - 1;
+                acul::string key = file_key(path);
+                for (const auto &loading : t_layout_chain)
+                    if (loading == key)
+                        throw acul::runtime_error(acul::format("Circular extends: %s", path.str().c_str()));
+                t_layout_chain.push_back(std::move(key));
             }
 
-            prev_parent = slot.parent;
+            ~LayoutChainGuard() { t_layout_chain.pop_back(); }
+        };
+    } // namespace
+
+    void extend_layout(Parser &p, const acul::path &base_path, IOInfo &io, FileProvider &files, ParseCache *cache)
+    {
+        if (!p.extends) return;
+        Parser layout;
+        load_layout(base_path / p.extends->path, base_path, layout, io, files, cache);
+        merge_blocks(layout, p, true);
+        // Blocks filled by `p` and the ones it adds inside them stay open for the next template in the chain.
+        layout.replace_map.clear();
+        collect_blocks(layout.replace_map, nullptr, layout.ast);
+        layout.arena.adopt(std::move(p.arena));
+        p = std::move(layout);
+    }
+
+    void load_layout(const acul::path &path, const acul::path &base_path, Parser &out, IOInfo &io,
+                     FileProvider &files, ParseCache *cache)
+    {
+        LayoutChainGuard guard(path);
+        if (cache)
+        {
+            cache->load_layout(path, base_path, out, io, files);
+            return;
         }
+        load_linked(path, base_path, out, io, files, nullptr);
+        extend_layout(out, base_path, io, files, nullptr);
     }
 
     void Linker::link(const acul::path &base_path, IOInfo &io)
     {
-        resolve_includes(_template, base_path, io);
+        acul::unique_ptr<IncludePrefetch> prefetch;
+        if (_pool && (!_template.replace_map.includes.empty() || _template.extends))
+        {
+            prefetch = acul::make_unique<IncludePrefetch>(*_pool, _files, base_path, _cache);
+            prefetch->queue_includes(_template);
+            if (_template.extends) prefetch->queue(base_path / _template.extends->path, LoadKind::layout);
+        }
+
+        resolve_slots(_template, base_path, io, _files, _cache, prefetch.get());
         if (!_template.extends) return;
+        // The whole layout chain comes back as one skeleton, so only the blocks of this template are spliced here.
         auto extend_path = base_path / _template.extends->path;
-        Parser extend_parser;
-        load_template(extend_path, extend_parser, io);
-        resolve_includes(extend_parser, base_path, io);
-        resolve_blocks(extend_parser, _template);
-        _template.ast = std::move(extend_parser.ast);
+        Parser layout;
+        if (!prefetch || !prefetch->take(extend_path, LoadKind::layout, layout, io))
+            load_layout(extend_path, base_path, layout, io, _files, _cache);
+        resolve_blocks(layout, _template);
+        _template.ast = std::move(layout.ast);
+        _template.arena.adopt(std::move(layout.arena));
         _template.replace_map.clear();
     }
 
-} // namespace ahtt
\ No newline at end of file
+} // namespace ahtt
@@ -3,34 +3,64 @@
 #include <acul/io/fs/file.hpp>
 #include <acul/io/path.hpp>
 #include <acul/log.hpp>
+#include "files.hpp"
 #include "parser.hpp"
+#include "profiler.hpp"
 
 namespace ahtt
 {
-    inline void load_template(const acul::path &path, Parser &p, IOInfo &io)
+    inline void load_template(const acul::path &path, Parser &p, IOInfo &io, FileProvider &files = disk_files())
     {
         LOG_INFO("Loading template file: %s", path.str().c_str());
-        acul::vector<char> file_buffer;
-        if (!acul::fs::read_binary(path.str(), file_buffer))
+        ProfileScope scope("load_template", &path);
+        SourceRef source = files.open(path);
+        if (!source)
             throw acul::runtime_error(acul::format("Failed to read template file: %s", path.str().c_str()));
+        p.arena.retain(source);
 
-        acul::string_view_pool<char> pool;
-        pool.reserve(file_buffer.size() / 15);
-        acul::fill_line_buffer(file_buffer.data(), file_buffer.size(), pool);
-        io.emplace_back(path, file_buffer.size());
+        io.emplace_back(path, source->size(), source);
 
-        p.ts = ahtt::lex_with_indents(pool);
+        p.ts = ahtt::lex_with_indents(source->data(), source->size());
         p.parse();
+        if (scope.active())
+        {
+            scope.bytes = source->size();
+            scope.nodes = count_nodes(p.ast);
+        }
     }
 
+    class ParseCache;
+    class WorkerPool;
+
+    // Splices every include of `p` in place. Included templates are taken from `cache` when one is given.
+    void resolve_includes(Parser &p, const acul::path &base_path, IOInfo &io, FileProvider &files,
+                          ParseCache *cache = nullptr);
+
+    // Fills `out` with the skeleton of the layout at `path`: its includes resolved and every layout it extends
+    // merged in, with all of its blocks still open for a template extending it. Skeletons are taken from
+    // `cache` when one is given, so each layout of a chain is resolved once.
+    void load_layout(const acul::path &path, const acul::path &base_path, Parser &out, IOInfo &io,
+                     FileProvider &files, ParseCache *cache = nullptr);
+
+    // Turns `p`, whose includes are resolved, into a skeleton by merging its blocks into the layout it extends.
+    void extend_layout(Parser &p, const acul::path &base_path, IOInfo &io, FileProvider &files,
+                       ParseCache *cache = nullptr);
+
     class Linker
     {
     public:
-        Linker(Parser &p) : _template(p) {}
+        // With a `pool`, includes and the layout are read and parsed on it ahead of splicing.
+        Linker(Parser &p, FileProvider &files = disk_files(), ParseCache *cache = nullptr, WorkerPool *pool = nullptr)
+            : _template(p), _files(files), _cache(cache), _pool(pool)
+        {
+        }
 
         void link(const acul::path &base_path, IOInfo &io);
 
     private:
         Parser &_template;
+        FileProvider &_files;
+        ParseCache *_cache;
+        WorkerPool *_pool;
     };
 } // namespace ahtt
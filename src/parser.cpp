@@ -1,64 +1,12 @@
 #include "parser.hpp"
 #include <acul/io/fs/path.hpp>
+#include <cstddef>
 
 namespace ahtt
 {
-    acul::vector<Tok> lex_with_indents(const acul::string_view_pool<char> &pool)
+    TextGroupNode *Parser::collect_text_nodes()
     {
-        acul::vector<Tok> out;
-        out.reserve(pool.size());
-        acul::vector<int> stack{0};
-        int line_no = 1;
-
-        for (const auto ln : pool)
-        {
-            int sp = 0;
-            const char *p = ln.data();
-            const char *end = ln.data() + ln.size();
-            while (p < end && *p == ' ')
-            {
-                ++sp;
-                ++p;
-            }
-
-            size_t content_len = static_cast<size_t>(end - p);
-            bool blank = (content_len == 0);
-            if (blank)
-                out.push_back({Tok::blank, {}, {line_no, 1}, (int)stack.size() - 1});
-            else
-            {
-                while (sp < stack.back())
-                {
-                    stack.pop_back();
-                    out.push_back({Tok::dedent, {}, {line_no, 1}, (int)stack.size() - 1});
-                }
-
-                if (sp > stack.back())
-                {
-                    stack.push_back(sp);
-                    out.push_back({Tok::indent, {}, {line_no, 1}, (int)stack.size() - 1});
-                }
-
-                acul::string_view content(p, content_len);
-                out.push_back({Tok::line, content, {line_no, sp + 1}, (int)stack.size() - 1});
-            }
-
-            ++line_no;
-        }
-
-        while (stack.size() > 1)
-        {
-            stack.pop_back();
-            out.push_back({Tok::dedent, {}, {line_no, 1}, (int)stack.size() - 1});
-        }
-
-        out.push_back({Tok::eof, {}, {line_no, 1}, 0});
-        return out;
-    }
-
-    acul::unique_ptr<TextGroupNode> Parser::collect_text_nodes()
-    {
-        auto group = acul::make_unique<TextGroupNode>();
+        auto group = arena.make<TextGroupNode>();
         if (at(Tok::line) || at(Tok::blank) || at(Tok::indent) || at(Tok::dedent)) group->pos = cur().pos;
 
         int base_level = -1;
@@ -71,19 +19,16 @@ namespace ahtt
         {
             if (at(Tok::line) || at(Tok::blank))
             {
-                auto tn = acul::make_unique<TextNode>();
+                auto tn = arena.make<TextNode>();
                 if (at(Tok::line))
                 {
                     const Tok &lt = cur();
-                    tn->text = acul::string(lt.sv);
+                    tn->text = lt.sv;
                     tn->pos = lt.pos;
                 }
                 else
-                {
-                    tn->text = acul::string();
                     tn->pos = cur().pos;
-                }
-                group->text_nodes.push_back(std::move(tn));
+                group->text_nodes.push_back(tn);
                 next();
                 continue;
             }
@@ -140,20 +85,20 @@ namespace ahtt
         m->pos = pos;
     }
 
-    static int paren_balance(acul::string_view s)
+    static int paren_balance(acul::string_view s, StructuralIndex &idx)
     {
-        bool in_s = false, in_d = false, esc = false;
+        idx.build(s);
+        const char *end = s.data() + s.size();
+        bool in_s = false, in_d = false;
         int bal = 0;
-        for (char c : s)
+        for (const uint32_t *it = idx.seek(s.data());; ++it)
         {
-            if (esc)
-            {
-                esc = false;
-                continue;
-            }
+            const char *p = idx.at(it);
+            if (p >= end) break;
+            char c = *p;
             if (c == '\\')
             {
-                esc = true;
+                if (idx.escapes_next(it, end)) ++it;
                 continue;
             }
             if (!in_d && c == '\'')
@@ -171,23 +116,25 @@ namespace ahtt
         return bal;
     }
 
-    NodeUP Parser::parse_html_node(const acul::string &s, const Tok &t, bool is_anonymous_allowed)
+    INode *Parser::parse_html_node(acul::string_view s, const Tok &t, bool is_anonymous_allowed)
     {
-        auto el = acul::make_unique<HTMLNode>();
-        acul::string trimmed = acul::trim_end(s);
+        auto el = arena.make<HTMLNode>();
+        acul::string_view trimmed = trim_view(s);
         bool is_dot_at_end = !trimmed.empty() && trimmed.back() == '.';
         el->head = s.substr(0, is_dot_at_end ? s.size() - 1 : s.size());
         el->pos = t.pos;
         next();
 
         size_t sp = el->head.find(' ');
-        acul::string_view html_head{el->head.c_str(), sp != acul::string::npos ? sp : el->head.size()};
-        bool is_ob_found = html_head.find('(') != acul::string::npos;
+        acul::string_view html_head = el->head.substr(0, sp);
+        bool is_ob_found = html_head.find('(') != acul::string_view::npos;
         if (is_ob_found)
         {
-            int bal = paren_balance(el->head);
+            int bal = paren_balance(el->head, _scan);
             if (bal > 0)
             {
+                // The only head that is not a slice of the source: continuation lines are joined here.
+                acul::string head(el->head);
                 int borrowed_indents = 0;
 
                 while (bal > 0)
@@ -208,11 +155,12 @@ namespace ahtt
                     if (!at(Tok::line)) break;
 
                     const Tok &lt2 = cur();
-                    el->head += ' ';
-                    el->head += acul::trim_start(lt2.sv);
-                    bal += paren_balance(acul::string_view(lt2.sv));
+                    head += ' ';
+                    head += trim_start_view(lt2.sv);
+                    bal += paren_balance(lt2.sv, _scan);
                     next();
                 }
+                el->head = arena.store(head);
 
                 while (borrowed_indents > 0 && at(Tok::dedent))
                 {
@@ -231,29 +179,29 @@ namespace ahtt
             {
                 next();
                 auto group = collect_text_nodes();
-                el->children.push_back(std::move(group));
+                el->children.push_back(group);
                 if (!at(Tok::dedent))
                     throw acul::runtime_error(acul::format("expected DEDENT after text block at line: %d, col: %d",
                                                            cur().pos.line, cur().pos.col));
                 next();
             }
             else
-                parse_children(el.get(), is_anonymous_allowed);
+                parse_children(el, is_anonymous_allowed);
         }
         return el;
     }
 
-    NodeUP Parser::parse_line(INode *parent, size_t parent_next_index, bool is_anonymous_allowed)
+    INode *Parser::parse_line(INode *parent, size_t parent_next_index, bool is_anonymous_allowed)
     {
         const Tok &t = cur();
-        acul::string s = acul::trim_start(t.sv);
+        acul::string_view s = trim_start_view(t.sv);
 
         // directives
         if (acul::starts_with(s, "extends "))
         {
-            auto p = acul::make_unique<ExtendsNode>();
-            extends = p.get();
-            p->path = trim(s.substr(8));
+            auto p = arena.make<ExtendsNode>();
+            extends = p;
+            p->path = acul::string(trim_view(s.substr(8)));
             p->pos = t.pos;
             next();
             return p;
@@ -263,29 +211,29 @@ namespace ahtt
         {
             BlockNode::Mode mode = BlockNode::replace;
             bool is_anonymous = s.size() == 5;
-            acul::string rest;
+            acul::string_view rest;
             if (!is_anonymous)
             {
-                rest = trim(s.substr(6));
+                rest = trim_view(s.substr(6));
                 is_anonymous = rest.empty();
             }
 
-            auto b = acul::make_unique<BlockNode>();
+            auto b = arena.make<BlockNode>();
             if (!is_anonymous)
             {
                 if (acul::starts_with(rest, "append "))
                 {
                     mode = BlockNode::append;
-                    b->name = trim(rest.substr(7));
+                    b->name = acul::string(trim_view(rest.substr(7)));
                 }
                 else if (acul::starts_with(rest, "prepend "))
                 {
                     mode = BlockNode::prepend;
-                    b->name = trim(rest.substr(8));
+                    b->name = acul::string(trim_view(rest.substr(8)));
                 }
                 else
-                    b->name = rest;
-                replace_map.emplace(b->name, b.get(), parent, parent_next_index);
+                    b->name = acul::string(rest);
+                replace_map.add_block(b->name, {b, parent, parent_next_index});
             }
             else if (!is_anonymous_allowed)
                 throw acul::runtime_error(
@@ -294,62 +242,62 @@ namespace ahtt
             b->pos = t.pos;
 
             next();
-            if (at(Tok::indent)) parse_children(b.get(), is_anonymous_allowed);
+            if (at(Tok::indent)) parse_children(b, is_anonymous_allowed);
             return b;
         }
 
         bool is_append_starts = acul::starts_with(s, "append ");
         if (is_append_starts || acul::starts_with(s, "prepend "))
         {
-            auto block = acul::make_unique<BlockNode>();
+            auto block = arena.make<BlockNode>();
             block->mode = is_append_starts ? BlockNode::append : BlockNode::prepend;
-            block->name = trim(s.substr(is_append_starts ? 7 : 8));
+            block->name = acul::string(trim_view(s.substr(is_append_starts ? 7 : 8)));
             block->pos = t.pos;
-            replace_map.emplace(block->name, block.get(), parent, parent_next_index);
+            replace_map.add_block(block->name, {block, parent, parent_next_index});
 
             next();
-            if (at(Tok::indent)) parse_children(block.get(), is_anonymous_allowed);
+            if (at(Tok::indent)) parse_children(block, is_anonymous_allowed);
             return block;
         }
 
         if (acul::starts_with(s, "mixin "))
         {
-            auto m = acul::make_unique<MixinDecl>();
+            auto m = arena.make<MixinDecl>();
             acul::string_view name{s.data() + 6, s.size() - 6};
-            parse_mixin(m.get(), name, t.pos);
+            parse_mixin(m, name, t.pos);
 
             next();
-            if (at(Tok::indent)) parse_children(m.get(), true);
+            if (at(Tok::indent)) parse_children(m, true);
             return m;
         }
 
         if (!s.empty() && s[0] == '+')
         {
-            auto m = acul::make_unique<MixinCall>();
+            auto m = arena.make<MixinCall>();
             acul::string_view name{s.data() + 1, s.size() - 1};
-            parse_mixin(m.get(), name, t.pos);
+            parse_mixin(m, name, t.pos);
 
             next();
-            if (at(Tok::indent)) parse_children(m.get(), is_anonymous_allowed);
+            if (at(Tok::indent)) parse_children(m, is_anonymous_allowed);
             return m;
         }
 
         // code / expr / text
         if (acul::starts_with(s, "- "))
         {
-            auto c = acul::make_unique<CodeNode>();
-            c->code = acul::string(s.substr(2));
+            auto c = arena.make<CodeNode>();
+            c->code = s.substr(2);
             c->pos = t.pos;
 
             next();
-            if (at(Tok::indent)) parse_children(c.get(), is_anonymous_allowed);
+            if (at(Tok::indent)) parse_children(c, is_anonymous_allowed);
             return c;
         }
 
         if (acul::starts_with(s, "= "))
         {
-            auto e = acul::make_unique<ExprNode>();
-            e->expr = acul::string(s.substr(2));
+            auto e = arena.make<ExprNode>();
+            e->expr = s.substr(2);
             e->pos = t.pos;
             next();
             return e;
@@ -357,8 +305,8 @@ namespace ahtt
 
         if (acul::starts_with(s, "|"))
         {
-            auto tnode = acul::make_unique<TextNode>();
-            tnode->text = trim(s.substr(1));
+            auto tnode = arena.make<TextNode>();
+            tnode->text = trim_view(s.substr(1));
             tnode->pos = t.pos;
             next();
             return tnode;
@@ -382,32 +330,32 @@ namespace ahtt
 
         if (acul::starts_with(s, "include "))
         {
-            auto include_node = acul::make_unique<IncludeNode>();
-            include_node->path = s.substr(8);
+            auto include_node = arena.make<IncludeNode>();
+            include_node->path = acul::string(s.substr(8));
             include_node->pos = t.pos;
             auto ext = acul::fs::get_extension(include_node->path);
             include_node->mode = ext == ".at" ? IncludeNode::Mode::at : IncludeNode::Mode::plain;
-            replace_map.emplace(include_node->path, include_node.get(), parent, parent_next_index);
+            replace_map.includes.push_back({include_node, parent, parent_next_index});
             next();
             return include_node;
         }
 
         if (acul::starts_with(s, "external"))
         {
-            auto ext = acul::make_unique<ExternalNode>();
+            auto ext = arena.make<ExternalNode>();
             ext->pos = t.pos;
-            auto ext_type_def = acul::trim(s.substr(8));
+            auto ext_type_def = trim_view(s.substr(8));
             ext->is_struct = ext_type_def == "struct";
 
             next();
-            if (at(Tok::indent)) parse_children(ext.get(), is_anonymous_allowed);
+            if (at(Tok::indent)) parse_children(ext, is_anonymous_allowed);
             return ext;
         }
 
         return parse_html_node(s, t, is_anonymous_allowed);
     }
 
-    void Parser::parse()
+    void Parser::parse(acul::vector<size_t> *starts)
     {
         while (!at(Tok::eof))
         {
@@ -431,6 +379,7 @@ namespace ahtt
                     throw acul::runtime_error(
                         acul::format("Leading indentation before first content is not allowed at line %d, col %d",
                                      t.pos.line, t.pos.col));
+                if (starts) starts->push_back(_pos);
                 ast.push_back(parse_line(nullptr, ast.size()));
                 continue;
             }
@@ -438,4 +387,182 @@ namespace ahtt
         }
     }
 
+    namespace
+    {
+        // Lays out the copy of a tree: one pass sizes it, the next copies it into a block reserved for it.
+        class TreeCloner
+        {
+        public:
+            TreeCloner(NodeArena &arena, NodeMap *map) : _arena(arena), _map(map && !map->empty() ? map : nullptr)
+            {
+            }
+
+            void measure(const INode *node)
+            {
+                switch (node->kind())
+                {
+                    case INode::Kind::text:
+                        add<TextNode>();
+                        break;
+                    case INode::Kind::text_group:
+                    {
+                        add<TextGroupNode>();
+                        size_t count = static_cast<const TextGroupNode *>(node)->text_nodes.size();
+                        _texts += count;
+                        for (size_t i = 0; i < count; ++i) add<TextNode>();
+                        break;
+                    }
+                    case INode::Kind::expr:
+                        add<ExprNode>();
+                        break;
+                    case INode::Kind::extends:
+                        add<ExtendsNode>();
+                        break;
+                    case INode::Kind::include:
+                        add<IncludeNode>();
+                        break;
+                    case INode::Kind::html:
+                        add<HTMLNode>();
+                        break;
+                    case INode::Kind::code:
+                        add<CodeNode>();
+                        break;
+                    case INode::Kind::block:
+                        add<BlockNode>();
+                        break;
+                    case INode::Kind::mixin_decl:
+                        add<MixinDecl>();
+                        break;
+                    case INode::Kind::mixin_call:
+                        add<MixinCall>();
+                        break;
+                    case INode::Kind::external:
+                        add<ExternalNode>();
+                        break;
+                    default:
+                        throw acul::runtime_error("unknown node kind");
+                }
+                if (!is_parent_kind(node->kind())) return;
+                const NodeList &children = static_cast<const ParentNode *>(node)->children;
+                _children += children.size();
+                for (const auto *child : children)
+                    if (child) measure(child);
+            }
+
+            // Reserves the measured size; every clone() after it stays within the reserved block.
+            void reserve()
+            {
+                _arena.reserve(_bytes + (_children + _texts + 2) * sizeof(void *), _objects);
+                _next_child = _arena.make_array<INode *>(_children);
+                _next_text = _arena.make_array<TextNode *>(_texts);
+            }
+
+            INode *clone(const INode *node)
+            {
+                INode *copy = copy_of(node);
+                if (_map)
+                {
+                    auto it = std::lower_bound(_map->begin(), _map->end(), node,
+                                               [](const auto &entry, const INode *key) { return entry.first < key; });
+                    if (it != _map->end() && it->first == node) it->second = copy;
+                }
+                return copy;
+            }
+
+        private:
+            NodeArena &_arena;
+            NodeMap *_map;
+            size_t _bytes = 0, _objects = 0, _children = 0, _texts = 0;
+            INode **_next_child = nullptr;
+            TextNode **_next_text = nullptr;
+
+            template <class T>
+            void add()
+            {
+                _bytes += (sizeof(T) + alignof(std::max_align_t) - 1) & ~(alignof(std::max_align_t) - 1);
+                ++_objects;
+            }
+
+            template <class T>
+            T *copy(const INode *node)
+            {
+                return _arena.make<T>(*static_cast<const T *>(node));
+            }
+
+            INode *copy_of(const INode *node)
+            {
+                ParentNode *parent;
+                switch (node->kind())
+                {
+                    case INode::Kind::text:
+                        return copy<TextNode>(node);
+                    case INode::Kind::text_group:
+                    {
+                        auto *src = static_cast<const TextGroupNode *>(node);
+                        auto *group = copy<TextGroupNode>(node);
+                        size_t count = src->text_nodes.size();
+                        group->text_nodes = PtrList<TextNode>(_next_text, count);
+                        _next_text += count;
+                        for (size_t i = 0; i < count; ++i) group->text_nodes[i] = copy<TextNode>(src->text_nodes[i]);
+                        return group;
+                    }
+                    case INode::Kind::expr:
+                        return copy<ExprNode>(node);
+                    case INode::Kind::extends:
+                        return copy<ExtendsNode>(node);
+                    case INode::Kind::include:
+                        return copy<IncludeNode>(node);
+                    case INode::Kind::html:
+                        parent = copy<HTMLNode>(node);
+                        break;
+                    case INode::Kind::code:
+                        parent = copy<CodeNode>(node);
+                        break;
+                    case INode::Kind::block:
+                        parent = copy<BlockNode>(node);
+                        break;
+                    case INode::Kind::mixin_decl:
+                        parent = copy<MixinDecl>(node);
+                        break;
+                    case INode::Kind::mixin_call:
+                        parent = copy<MixinCall>(node);
+                        break;
+                    case INode::Kind::external:
+                        parent = copy<ExternalNode>(node);
+                        break;
+                    default:
+                        throw acul::runtime_error("unknown node kind");
+                }
+                const NodeList &children = static_cast<const ParentNode *>(node)->children;
+                size_t count = children.size();
+                parent->children = NodeList(_next_child, count);
+                _next_child += count;
+                for (size_t i = 0; i < count; ++i)
+                    parent->children[i] = children[i] ? clone(children[i]) : nullptr;
+                return parent;
+            }
+        };
+    } // namespace
+
+    void clone_nodes(const NodeList &src, NodeList &dst, NodeArena &arena, NodeMap *map)
+    {
+        TreeCloner cloner(arena, map);
+        for (const auto *node : src)
+            if (node) cloner.measure(node);
+        cloner.reserve();
+        dst.reserve(dst.size() + src.size());
+        for (const auto *node : src) dst.push_back(node ? cloner.clone(node) : nullptr);
+    }
+
+    size_t count_nodes(const NodeList &nodes)
+    {
+        size_t count = 0;
+        for (const auto *node : nodes)
+        {
+            if (!node) continue;
+            ++count;
+            if (is_parent_kind(node->kind())) count += count_nodes(static_cast<const ParentNode *>(node)->children);
+        }
+        return count;
+    }
 } // namespace ahtt
\ No newline at end of file
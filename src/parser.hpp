@@ -2,10 +2,15 @@
 
 #include <acul/hash/hashmap.hpp>
 #include <acul/io/path.hpp>
-#include <acul/memory/smart_ptr.hpp>
 #include <acul/string/string_view_pool.hpp>
 #include <acul/string/utils.hpp>
 #include <acul/vector.hpp>
+#include <algorithm>
+#include <iterator>
+#include <utility>
+#include "arena.hpp"
+#include "files.hpp"
+#include "scanner.hpp"
 
 namespace ahtt
 {
@@ -15,6 +20,22 @@ namespace ahtt
         int line = 1, col = 1;
     };
 
+    // Whitespace trimming that returns views, so node text can keep pointing into the source.
+    inline acul::string_view trim_start_view(acul::string_view s)
+    {
+        size_t i = 0;
+        while (i < s.size() && isspace(static_cast<unsigned char>(s[i]))) ++i;
+        return s.substr(i);
+    }
+
+    inline acul::string_view trim_view(acul::string_view s)
+    {
+        s = trim_start_view(s);
+        size_t n = s.size();
+        while (n > 0 && isspace(static_cast<unsigned char>(s[n - 1]))) --n;
+        return s.substr(0, n);
+    }
+
     // -------------------- Tokens --------------------
     struct Tok
     {
@@ -31,9 +52,11 @@ namespace ahtt
         int level = 0;
     };
 
+    // Nodes live in the NodeArena of the parse that created them; the kind tag replaces virtual dispatch.
+    // Text fields are views into the template source or into the arena.
     struct INode
     {
-        enum class Kind
+        enum class Kind : uint8_t
         {
             text,
             text_group,
@@ -50,48 +73,155 @@ namespace ahtt
 
         Pos pos;
 
-        virtual ~INode() = default;
-        virtual Kind kind() const = 0;
-        virtual acul::unique_ptr<INode> clone() const = 0;
+        Kind kind() const { return _kind; }
+
+    protected:
+        explicit INode(Kind kind) : _kind(kind) {}
+
+    private:
+        Kind _kind;
     };
 
-    using NodeUP = acul::unique_ptr<INode>;
-    using NodeList = acul::vector<NodeUP>;
+    // List of node pointers. Lists built by the parser and the linker own their storage; the lists of a cloned or
+    // loaded tree are ranges of one contiguous array in the tree's arena and get storage of their own only once
+    // they outgrow it.
+    template <class T>
+    class PtrList
+    {
+    public:
+        using value_type = T *;
+        using iterator = T **;
+        using const_iterator = T *const *;
+
+        PtrList() = default;
+        PtrList(T **range, size_t size) : _data(range), _size(size), _capacity(size) {}
+        PtrList(const PtrList &other) { insert(end(), other.begin(), other.end()); }
+        PtrList(PtrList &&other) noexcept { take(other); }
+        ~PtrList() { release(); }
+
+        PtrList &operator=(const PtrList &other)
+        {
+            if (this != &other)
+            {
+                clear();
+                insert(end(), other.begin(), other.end());
+            }
+            return *this;
+        }
+
+        PtrList &operator=(PtrList &&other) noexcept
+        {
+            if (this != &other)
+            {
+                release();
+                take(other);
+            }
+            return *this;
+        }
+
+        size_t size() const { return _size; }
+        bool empty() const { return _size == 0; }
+        iterator begin() { return _data; }
+        iterator end() { return _data + _size; }
+        const_iterator begin() const { return _data; }
+        const_iterator end() const { return _data + _size; }
+        T *&operator[](size_t i) { return _data[i]; }
+        T *operator[](size_t i) const { return _data[i]; }
+        T *&front() { return _data[0]; }
+        T *&back() { return _data[_size - 1]; }
+
+        void reserve(size_t n)
+        {
+            if (n > _capacity) grow(n);
+        }
+
+        void resize(size_t n)
+        {
+            reserve(n);
+            for (size_t i = _size; i < n; ++i) _data[i] = nullptr;
+            _size = n;
+        }
+
+        void clear() { _size = 0; }
+
+        void push_back(T *node)
+        {
+            if (_size == _capacity) grow(_size + 1);
+            _data[_size++] = node;
+        }
+
+        // `first` and `last` must not point into this list.
+        template <class It>
+        iterator insert(const_iterator pos, It first, It last)
+        {
+            size_t at = static_cast<size_t>(pos - _data);
+            size_t n = static_cast<size_t>(std::distance(first, last));
+            if (_size + n > _capacity) grow(_size + n);
+            if (at < _size) memmove(_data + at + n, _data + at, (_size - at) * sizeof(T *));
+            std::copy(first, last, _data + at);
+            _size += n;
+            return _data + at;
+        }
+
+    private:
+        T **_data = nullptr;
+        size_t _size = 0;
+        size_t _capacity = 0;
+        bool _owned = false; // false for an arena range, which the arena frees
+
+        void grow(size_t min)
+        {
+            size_t capacity = std::max({min, _capacity * 2, size_t(4)});
+            auto **data = static_cast<T **>(::operator new(capacity * sizeof(T *)));
+            if (_size) memcpy(data, _data, _size * sizeof(T *));
+            release();
+            _data = data;
+            _capacity = capacity;
+            _owned = true;
+        }
+
+        void release()
+        {
+            if (_owned) ::operator delete(_data);
+            _owned = false;
+        }
+
+        void take(PtrList &other)
+        {
+            _data = other._data;
+            _size = other._size;
+            _capacity = other._capacity;
+            _owned = other._owned;
+            other._data = nullptr;
+            other._size = other._capacity = 0;
+            other._owned = false;
+        }
+    };
+
+    using NodeList = PtrList<INode>;
 
     struct ParentNode : INode
     {
         NodeList children;
+
+    protected:
+        using INode::INode;
+        // Copies leave the children out, for clone_nodes to lay them out.
+        ParentNode(const ParentNode &other) : INode(other) {}
     };
 
     struct HTMLNode : ParentNode
     {
-        acul::string head;
-        Kind kind() const override { return Kind::html; }
+        acul::string_view head;
 
-        acul::unique_ptr<INode> clone() const override
-        {
-            auto p = acul::make_unique<HTMLNode>();
-            p->head = head;
-            p->pos = pos;
-            for (auto &ch : children) p->children.push_back(ch->clone());
-            return p;
-        }
+        HTMLNode() : ParentNode(Kind::html) {}
     };
 
     struct CodeNode : ParentNode
     {
-        acul::string code;
-
-        Kind kind() const override { return Kind::code; }
+        acul::string_view code;
 
-        acul::unique_ptr<INode> clone() const override
-        {
-            auto p = acul::make_unique<CodeNode>();
-            p->code = code;
-            p->pos = pos;
-            for (auto &ch : children) p->children.push_back(ch->clone());
-            return p;
-        }
+        CodeNode() : ParentNode(Kind::code) {}
     };
 
     struct BlockNode : ParentNode
@@ -104,17 +234,7 @@ namespace ahtt
         } mode = replace;
         acul::string name;
 
-        Kind kind() const override { return Kind::block; }
-
-        acul::unique_ptr<INode> clone() const override
-        {
-            auto p = acul::make_unique<BlockNode>();
-            p->mode = mode;
-            p->name = name;
-            p->pos = pos;
-            for (auto &ch : children) p->children.push_back(ch->clone());
-            return p;
-        }
+        BlockNode() : ParentNode(Kind::block) {}
     };
 
     struct IncludeNode : INode
@@ -126,9 +246,7 @@ namespace ahtt
             plain
         } mode;
 
-        virtual Kind kind() const override { return Kind::include; }
-
-        virtual acul::unique_ptr<INode> clone() const override { return acul::make_unique<IncludeNode>(*this); }
+        IncludeNode() : INode(Kind::include) {}
     };
 
     struct MixinDecl : ParentNode
@@ -137,72 +255,79 @@ namespace ahtt
         acul::vector<acul::string> args;
         bool has_block = false;
 
-        Kind kind() const override { return Kind::mixin_decl; }
+        MixinDecl() : ParentNode(Kind::mixin_decl) {}
 
-        acul::unique_ptr<INode> clone() const override
-        {
-            auto p = acul::make_unique<MixinDecl>();
-            p->name = name;
-            p->pos = pos;
-            for (auto &ch : children) p->children.push_back(ch->clone());
-            return p;
-        }
+    protected:
+        explicit MixinDecl(Kind kind) : ParentNode(kind) {}
     };
 
     struct MixinCall : MixinDecl
     {
-        virtual Kind kind() const override { return Kind::mixin_call; }
+        MixinCall() : MixinDecl(Kind::mixin_call) {}
     };
 
     struct TextNode : INode
     {
-        acul::string text;
-        Kind kind() const override { return Kind::text; }
-        acul::unique_ptr<INode> clone() const override { return acul::make_unique<TextNode>(*this); }
+        acul::string_view text;
+
+        TextNode() : INode(Kind::text) {}
     };
 
     struct TextGroupNode : INode
     {
-        acul::vector<acul::unique_ptr<TextNode>> text_nodes;
-        Kind kind() const override { return Kind::text_group; }
+        PtrList<TextNode> text_nodes;
 
-        acul::unique_ptr<INode> clone() const override
-        {
-            auto p = acul::make_unique<TextGroupNode>();
-            p->pos = pos;
-            for (const auto &ch : text_nodes) p->text_nodes.push_back(acul::make_unique<TextNode>(*ch));
-            return p;
-        }
+        TextGroupNode() : INode(Kind::text_group) {}
+        // Copies leave the text nodes out, for clone_nodes to lay them out.
+        TextGroupNode(const TextGroupNode &other) : INode(other) {}
     };
 
     struct ExprNode : INode
     {
-        acul::string expr;
-        Kind kind() const override { return Kind::expr; }
-        acul::unique_ptr<INode> clone() const override { return acul::make_unique<ExprNode>(*this); }
+        acul::string_view expr;
+
+        ExprNode() : INode(Kind::expr) {}
     };
 
     struct ExtendsNode : INode
     {
         acul::string path;
-        Kind kind() const override { return Kind::extends; }
-        acul::unique_ptr<INode> clone() const override { return acul::make_unique<ExtendsNode>(*this); }
+
+        ExtendsNode() : INode(Kind::extends) {}
     };
 
     struct ExternalNode : ParentNode
     {
         bool is_struct;
 
-        virtual Kind kind() const override { return Kind::external; }
+        ExternalNode() : ParentNode(Kind::external) {}
+    };
 
-        virtual acul::unique_ptr<INode> clone() const override
+    inline bool is_parent_kind(INode::Kind k)
+    {
+        switch (k)
         {
-            auto p = acul::make_unique<ExternalNode>();
-            p->pos = pos;
-            for (auto &ch : children) p->children.push_back(ch->clone());
-            return p;
+            case INode::Kind::html:
+            case INode::Kind::code:
+            case INode::Kind::block:
+            case INode::Kind::mixin_decl:
+            case INode::Kind::mixin_call:
+            case INode::Kind::external:
+                return true;
+            default:
+                return false;
         }
-    };
+    }
+
+    // Source nodes paired with their copies, sorted by source.
+    using NodeMap = acul::vector<std::pair<const INode *, INode *>>;
+
+    // Deep-copies `src` into `dst`. The copies and all of their child lists are laid out in one block of `arena`,
+    // so a clone costs no allocation per node. The copy of every source node listed in `map` is recorded there.
+    void clone_nodes(const NodeList &src, NodeList &dst, NodeArena &arena, NodeMap *map = nullptr);
+
+    // Number of nodes in `nodes` and all of their descendants.
+    size_t count_nodes(const NodeList &nodes);
 
     struct ReplaceSlot
     {
@@ -211,35 +336,73 @@ namespace ahtt
         size_t offset = 0;
     };
 
+    // Splice points of a parse. Block names are interned once to ids that index `blocks`, so the linker
+    // works on integers; includes are kept in parse order since one path may be included several times.
+    struct ReplaceMap
+    {
+        static constexpr uint32_t npos = UINT32_MAX;
+
+        acul::hashmap<acul::string, uint32_t> ids;
+        acul::vector<ReplaceSlot> blocks;
+        acul::vector<ReplaceSlot> includes;
+
+        // The first block of a name is the one that gets replaced.
+        void add_block(const acul::string &name, const ReplaceSlot &slot)
+        {
+            if (ids.emplace(name, static_cast<uint32_t>(blocks.size())).second) blocks.push_back(slot);
+        }
+
+        uint32_t find(const acul::string &name) const
+        {
+            auto it = ids.find(name);
+            return it == ids.end() ? npos : it->second;
+        }
+
+        void clear()
+        {
+            ids.clear();
+            blocks.clear();
+            includes.clear();
+        }
+    };
+
     // -------------------- Parser --------------------
     struct Parser
     {
+        // Owns every node reachable from ast, replace_map and extends.
+        NodeArena arena;
         ExtendsNode *extends = nullptr;
-        acul::hashmap<acul::string, ReplaceSlot> replace_map;
+        ReplaceMap replace_map;
         NodeList ast;
         acul::vector<Tok> ts;
 
-        void parse();
+        // With `starts`, the index in `ts` of the first line of every top-level node is appended to it.
+        void parse(acul::vector<size_t> *starts = nullptr);
 
     private:
         size_t _pos = 0;
+        StructuralIndex _scan;
         bool at(Tok::Kind k) const { return ts[_pos].kind == k; }
         const Tok &cur() const { return ts[_pos]; }
         const Tok &next() { return ts[_pos++]; }
 
-        acul::unique_ptr<TextGroupNode> collect_text_nodes();
-        NodeUP parse_line(INode *parent, size_t parent_next_index, bool is_anonymous_allowed = false);
-        NodeUP parse_html_node(const acul::string &s, const Tok &t, bool is_anonymous_allowed);
+        TextGroupNode *collect_text_nodes();
+        INode *parse_line(INode *parent, size_t parent_next_index, bool is_anonymous_allowed = false);
+        INode *parse_html_node(acul::string_view s, const Tok &t, bool is_anonymous_allowed);
 
         void parse_children(ParentNode *node, bool is_anonymous_allowed);
     };
 
-    acul::vector<Tok> lex_with_indents(const acul::string_view_pool<char> &pool);
+    // Splits `data` into lines and emits indent/dedent/blank/line tokens in a single pass. Token text points
+    // into `data`, which must outlive the tokens. Lines are numbered from `first_line`, so a slice starting at
+    // a line with no indentation lexes the same as within the whole file.
+    acul::vector<Tok> lex_with_indents(const char *data, size_t size, int first_line = 1);
 
     struct FileInfo
     {
         acul::path path;
         size_t file_size;
+        SourceRef source; // bytes the parse read, if known
     };
 
     using IOInfo = acul::vector<FileInfo>;
@@ -0,0 +1,109 @@
+#include "profiler.hpp"
+#include <acul/io/fs/file.hpp>
+#include <acul/string/sstream.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+
+namespace ahtt
+{
+    static std::atomic<Profiler *> g_profiler{nullptr};
+
+    Profiler *active_profiler() { return g_profiler.load(std::memory_order_acquire); }
+
+    void set_active_profiler(Profiler *profiler) { g_profiler.store(profiler, std::memory_order_release); }
+
+    static uint32_t thread_index()
+    {
+        static std::atomic<uint32_t> next{1};
+        thread_local uint32_t index = next.fetch_add(1, std::memory_order_relaxed);
+        return index;
+    }
+
+    ProfileScope::~ProfileScope()
+    {
+        if (!_profiler) return;
+        uint64_t end = _profiler->now();
+        _profiler->add({_phase, _file ? _file->str() : acul::string(), _start, end - _start, thread_index(), bytes,
+                        nodes});
+    }
+
+    void Profiler::add(Span &&span)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _spans.push_back(std::move(span));
+    }
+
+    static void write_escaped(acul::stringstream &ss, const acul::string &s)
+    {
+        for (char c : s)
+        {
+            if (c == '"' || c == '\\')
+                ss << '\\' << c;
+            else if (static_cast<unsigned char>(c) < 0x20)
+                ss << acul::format("\\u%04x", c);
+            else
+                ss << c;
+        }
+    }
+
+    bool Profiler::write_trace(const acul::path &path) const
+    {
+        acul::stringstream ss;
+        ss << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            for (size_t i = 0; i < _spans.size(); ++i)
+            {
+                const auto &s = _spans[i];
+                ss << (i ? ",\n" : "\n") << "{\"name\":\"" << s.phase
+                   << "\",\"cat\":\"ahtt\",\"ph\":\"X\",\"pid\":1,\"tid\":" << s.thread
+                   << ",\"ts\":" << acul::format("%.3f", s.start_ns / 1e3) << ",\"dur\":"
+                   << acul::format("%.3f", s.duration_ns / 1e3) << ",\"args\":{\"file\":\"";
+                write_escaped(ss, s.file);
+                ss << "\",\"bytes\":" << s.bytes << ",\"nodes\":" << s.nodes << "}}";
+            }
+        }
+        ss << "\n]}\n";
+        auto trace = ss.str();
+        return acul::fs::write_binary(path.str(), trace.data(), trace.size());
+    }
+
+    acul::string Profiler::summary() const
+    {
+        struct Total
+        {
+            const char *phase;
+            uint64_t ns;
+            size_t count;
+        };
+        acul::vector<Total> totals;
+        size_t files = 0, bytes = 0;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            for (const auto &s : _spans)
+            {
+                auto it = std::find_if(totals.begin(), totals.end(),
+                                       [&](const Total &t) { return strcmp(t.phase, s.phase) == 0; });
+                if (it == totals.end())
+                    totals.push_back({s.phase, s.duration_ns, 1});
+                else
+                {
+                    it->ns += s.duration_ns;
+                    ++it->count;
+                }
+                if (strcmp(s.phase, "load_template") == 0)
+                {
+                    ++files;
+                    bytes += s.bytes;
+                }
+            }
+        }
+
+        acul::stringstream ss;
+        ss << "profile: " << files << " files, " << acul::format("%.1f KiB", bytes / 1024.0);
+        for (const auto &t : totals)
+            ss << ", " << t.phase << ' ' << acul::format("%.2f ms", t.ns / 1e6) << " (" << t.count << ')';
+        return ss.str();
+    }
+} // namespace ahtt
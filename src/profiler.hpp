@@ -0,0 +1,80 @@
+#pragma once
+
+#include <acul/io/path.hpp>
+#include <acul/string/string.hpp>
+#include <acul/vector.hpp>
+#include <chrono>
+#include <mutex>
+
+namespace ahtt
+{
+    // Collects timed spans of the transpile phases. Thread-safe.
+    class Profiler
+    {
+    public:
+        struct Span
+        {
+            const char *phase;
+            acul::string file;
+            uint64_t start_ns;
+            uint64_t duration_ns;
+            uint32_t thread;
+            size_t bytes;
+            size_t nodes;
+        };
+
+        Profiler() : _start(std::chrono::steady_clock::now()) {}
+
+        // Nanoseconds since the profiler was created.
+        uint64_t now() const
+        {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - _start)
+                .count();
+        }
+
+        void add(Span &&span);
+
+        // Writes the spans as Chrome trace-event JSON (Perfetto, chrome://tracing).
+        bool write_trace(const acul::path &path) const;
+
+        // One line with the inclusive time of every phase.
+        acul::string summary() const;
+
+    private:
+        std::chrono::steady_clock::time_point _start;
+        mutable std::mutex _mutex;
+        acul::vector<Span> _spans;
+    };
+
+    // Profiler the transpile phases report to; null unless profiling was requested.
+    Profiler *active_profiler();
+    void set_active_profiler(Profiler *profiler);
+
+    // Records the lifetime of the scope as one span of the active profiler. `bytes` and `nodes` are
+    // only worth filling in when active() is true.
+    class ProfileScope
+    {
+    public:
+        explicit ProfileScope(const char *phase, const acul::path *file = nullptr)
+            : _profiler(active_profiler()), _phase(phase), _file(file)
+        {
+            if (_profiler) _start = _profiler->now();
+        }
+
+        ~ProfileScope();
+
+        ProfileScope(const ProfileScope &) = delete;
+        ProfileScope &operator=(const ProfileScope &) = delete;
+
+        bool active() const { return _profiler != nullptr; }
+
+        size_t bytes = 0;
+        size_t nodes = 0;
+
+    private:
+        Profiler *_profiler;
+        const char *_phase;
+        const acul::path *_file;
+        uint64_t _start = 0;
+    };
+} // namespace ahtt
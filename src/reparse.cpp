@@ -0,0 +1,171 @@
+#include "reparse.hpp"
+#include <algorithm>
+
+namespace ahtt
+{
+    // Collects the slots of `node` and its descendants in the order the parser registers them.
+    static void collect_slots(INode *node, INode *parent, size_t offset, acul::vector<ReplaceSlot> &slots,
+                              ExtendsNode *&extends)
+    {
+        switch (node->kind())
+        {
+            case INode::Kind::block:
+                if (!static_cast<BlockNode *>(node)->name.empty()) slots.push_back({node, parent, offset});
+                break;
+            case INode::Kind::include:
+                slots.push_back({node, parent, offset});
+                break;
+            case INode::Kind::extends:
+                extends = static_cast<ExtendsNode *>(node);
+                break;
+            default:
+                break;
+        }
+        if (!is_parent_kind(node->kind())) return;
+        auto &children = static_cast<ParentNode *>(node)->children;
+        for (size_t i = 0; i < children.size(); ++i)
+            if (children[i]) collect_slots(children[i], node, i, slots, extends);
+    }
+
+    static void shift_lines(INode *node, int delta)
+    {
+        node->pos.line += delta;
+        if (node->kind() == INode::Kind::text_group)
+            for (auto *text : static_cast<TextGroupNode *>(node)->text_nodes) text->pos.line += delta;
+        else if (is_parent_kind(node->kind()))
+            for (auto *child : static_cast<ParentNode *>(node)->children)
+                if (child) shift_lines(child, delta);
+    }
+
+    size_t IncrementalParse::update(const SourceRef &source)
+    {
+        const char *data = source->data();
+        size_t size = source->size();
+        size_t n = _nodes.size();
+
+        // Old nodes [first, last) are replaced by the nodes parsed from [start, end) of the new source.
+        size_t first = 0, last = n, start = 0;
+        size_t old_end = 0, new_end = size;
+        // Replaced nodes stay in their arenas, so once as much as the file was re-parsed it is parsed anew.
+        bool full = !_source || n == 0 || _reparsed > size;
+        if (!full)
+        {
+            const char *old = _source->data();
+            size_t old_size = _source->size();
+            size_t common = std::min(size, old_size);
+            size_t prefix = static_cast<size_t>(std::mismatch(data, data + common, old).first - data);
+            if (prefix == size && size == old_size)
+            {
+                _source = source;
+                return 0;
+            }
+            size_t suffix = 0;
+            while (suffix < common - prefix && data[size - 1 - suffix] == old[old_size - 1 - suffix]) ++suffix;
+            old_end = old_size - suffix;
+            new_end = size - suffix;
+
+            // The node before the edit is re-parsed too: indented lines inserted after it become its children.
+            auto by_begin = [](const TopNode &node, size_t offset) { return node.begin < offset; };
+            first = static_cast<size_t>(std::lower_bound(_nodes.begin(), _nodes.end(), prefix, by_begin) - _nodes.begin());
+            first = first ? first - 1 : 0;
+            start = first ? _nodes[first].begin : 0;
+            last = static_cast<size_t>(
+                std::lower_bound(_nodes.begin() + first, _nodes.end(), old_end, by_begin) - _nodes.begin());
+        }
+
+        // Parsing resumes at the first old node after the edit that still starts a line. A node left open at
+        // the end of the slice, e.g. attributes continued over the following lines or a construct not closed yet
+        // mid-edit, fails to parse there, so the slice doubles in nodes until it parses or reaches the end of the
+        // file. Doubling keeps a failing edit at a few lexes of the file instead of one per node after it.
+        Parser seg;
+        acul::vector<size_t> starts;
+        size_t end = size;
+        for (;;)
+        {
+            for (; last < n; ++last)
+            {
+                end = _nodes[last].begin - old_end + new_end;
+                if (end == 0 || data[end - 1] == '\n') break;
+            }
+            if (last >= n) end = size;
+            seg = Parser();
+            starts.clear();
+            try
+            {
+                seg.ts = lex_with_indents(data + start, end - start, start ? _nodes[first].line : 1);
+                seg.parse(&starts);
+                break;
+            }
+            catch (const std::exception &)
+            {
+                if (last >= n) throw;
+                last = std::min(n, last + std::max<size_t>(last - first, 1));
+            }
+        }
+
+        acul::vector<TopNode> nodes;
+        nodes.reserve(first + seg.ast.size() + (n - last));
+        NodeList ast;
+        ast.reserve(nodes.capacity());
+        for (size_t k = 0; k < first; ++k)
+        {
+            nodes.push_back(std::move(_nodes[k]));
+            ast.push_back(_tree.ast[k]);
+        }
+        for (size_t k = 0; k < seg.ast.size(); ++k)
+        {
+            const Tok &t = seg.ts[starts[k]];
+            TopNode node{static_cast<size_t>(t.sv.data() - data), t.pos.line, {}, nullptr};
+            collect_slots(seg.ast[k], nullptr, 0, node.slots, node.extends);
+            nodes.push_back(std::move(node));
+            ast.push_back(seg.ast[k]);
+        }
+        if (last < n)
+        {
+            // Reused nodes only move; their positions are rewritten only if the edit changed the line count.
+            int lines = seg.ts.back().pos.line - _nodes[last].line;
+            for (size_t k = last; k < n; ++k)
+            {
+                TopNode &node = _nodes[k];
+                node.begin = node.begin - old_end + new_end;
+                node.line += lines;
+                if (lines) shift_lines(_tree.ast[k], lines);
+                nodes.push_back(std::move(node));
+                ast.push_back(_tree.ast[k]);
+            }
+        }
+
+        seg.arena.retain(source);
+        if (full)
+        {
+            _arenas.clear();
+            _reparsed = 0;
+        }
+        _arenas.push_back(std::make_shared<NodeArena>(std::move(seg.arena)));
+        _reparsed += end - start;
+        _source = source;
+        _nodes = std::move(nodes);
+        _tree.ast = std::move(ast);
+        rebuild_tree();
+        return end - start;
+    }
+
+    void IncrementalParse::rebuild_tree()
+    {
+        auto &map = _tree.replace_map;
+        map.clear();
+        _tree.extends = nullptr;
+        for (size_t k = 0; k < _nodes.size(); ++k)
+        {
+            for (ReplaceSlot slot : _nodes[k].slots)
+            {
+                if (!slot.parent) slot.offset = k;
+                if (slot.node->kind() == INode::Kind::include)
+                    map.includes.push_back(slot);
+                else
+                    map.add_block(static_cast<BlockNode *>(slot.node)->name, slot);
+            }
+            if (_nodes[k].extends) _tree.extends = _nodes[k].extends;
+        }
+    }
+} // namespace ahtt
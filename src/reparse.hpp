@@ -0,0 +1,45 @@
+#pragma once
+
+#include <memory>
+#include "files.hpp"
+#include "parser.hpp"
+
+namespace ahtt
+{
+    // Parse of one file kept between versions of it. A new version only re-lexes and re-parses the top-level
+    // nodes the edit touches and reuses the rest, which keep pointing into the sources they were parsed from.
+    class IncrementalParse
+    {
+    public:
+        // Brings the tree up to date with `source` and returns the number of bytes re-parsed. On a parse
+        // error the previous tree is kept.
+        size_t update(const SourceRef &source);
+
+        // Nodes, replace slots and extends of the current version; the nodes live in arenas().
+        const Parser &tree() const { return _tree; }
+
+        // Arenas of every node in tree(), to be retained by copies of it.
+        const acul::vector<std::shared_ptr<const NodeArena>> &arenas() const { return _arenas; }
+
+        const SourceRef &source() const { return _source; }
+        size_t size() const { return _source ? _source->size() : 0; }
+
+    private:
+        struct TopNode
+        {
+            size_t begin; // offset of its first line in the source
+            int line;
+            // Blocks and includes in document order, including blocks whose name is taken already.
+            acul::vector<ReplaceSlot> slots;
+            ExtendsNode *extends = nullptr;
+        };
+
+        SourceRef _source;
+        Parser _tree;
+        acul::vector<TopNode> _nodes;
+        acul::vector<std::shared_ptr<const NodeArena>> _arenas;
+        size_t _reparsed = 0; // bytes re-parsed since the last full parse
+
+        void rebuild_tree();
+    };
+} // namespace ahtt
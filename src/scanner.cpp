@@ -0,0 +1,235 @@
+#include "scanner.hpp"
+#include <algorithm>
+#include <cstring>
+#include "simd.hpp"
+
+namespace ahtt
+{
+    namespace
+    {
+        inline bool is_structural(const char *p, const char *end)
+        {
+            switch (*p)
+            {
+                case '\'':
+                case '"':
+                case '\\':
+                case '(':
+                case ')':
+                case '{':
+                case '}':
+                    return true;
+                case '#':
+                    return p + 1 < end && p[1] == '{';
+                case '_':
+                    return p + 1 < end && p[1] == '(';
+                default:
+                    return false;
+            }
+        }
+
+#if AHTT_SIMD_X86
+        // `next` is the block shifted by one byte, pairing every byte with its successor for "#{" and "_(".
+        struct SSE2Kernel
+        {
+            static constexpr size_t width = 16;
+
+            static inline unsigned block(const char *p)
+            {
+                __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+                __m128i next = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 1));
+                __m128i m = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\'')), _mm_cmpeq_epi8(v, _mm_set1_epi8('"')));
+                m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('\\')));
+                // '(' and ')' differ only in the lowest bit
+                m = _mm_or_si128(m, _mm_cmpeq_epi8(_mm_or_si128(v, _mm_set1_epi8(1)), _mm_set1_epi8(')')));
+                m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('{')));
+                m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('}')));
+                m = _mm_or_si128(m, _mm_and_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('#')),
+                                                  _mm_cmpeq_epi8(next, _mm_set1_epi8('{'))));
+                m = _mm_or_si128(m, _mm_and_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('_')),
+                                                  _mm_cmpeq_epi8(next, _mm_set1_epi8('('))));
+                return static_cast<unsigned>(_mm_movemask_epi8(m));
+            }
+        };
+
+        struct AVX2Kernel
+        {
+            static constexpr size_t width = 32;
+
+            AHTT_TARGET_AVX2 static inline unsigned block(const char *p)
+            {
+                __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+                __m256i next = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + 1));
+                __m256i m = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\'')),
+                                            _mm256_cmpeq_epi8(v, _mm256_set1_epi8('"')));
+                m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\')));
+                m = _mm256_or_si256(m, _mm256_cmpeq_epi8(_mm256_or_si256(v, _mm256_set1_epi8(1)),
+                                                         _mm256_set1_epi8(')')));
+                m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('{')));
+                m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('}')));
+                m = _mm256_or_si256(m, _mm256_and_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('#')),
+                                                        _mm256_cmpeq_epi8(next, _mm256_set1_epi8('{'))));
+                m = _mm256_or_si256(m, _mm256_and_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('_')),
+                                                        _mm256_cmpeq_epi8(next, _mm256_set1_epi8('('))));
+                return static_cast<unsigned>(_mm256_movemask_epi8(m));
+            }
+        };
+#endif
+    } // namespace
+
+#if AHTT_SIMD_X86
+    template <class Kernel>
+    AHTT_ALWAYS_INLINE static void classify(const char *data, size_t size, acul::vector<uint32_t> &out)
+    {
+        auto push = [&out](size_t base, unsigned mask) {
+            while (mask)
+            {
+                out.push_back(static_cast<uint32_t>(base + simd::ctz32(mask)));
+                mask &= mask - 1;
+            }
+        };
+
+        size_t i = 0;
+        for (; i + Kernel::width < size; i += Kernel::width) push(i, Kernel::block(data + i));
+
+        // Most heads are shorter than one block: classify the rest from a zero-padded copy instead of
+        // byte by byte. The padding never pairs with '#' or '_'.
+        size_t rest = size - i;
+        if (rest == 0) return;
+        char buf[Kernel::width + 1] = {};
+        memcpy(buf, data + i, rest);
+        unsigned valid = rest < 32 ? (1u << rest) - 1 : ~0u;
+        push(i, Kernel::block(buf) & valid);
+    }
+#endif
+
+    using ClassifyFn = void (*)(const char *, size_t, acul::vector<uint32_t> &);
+
+#if AHTT_SIMD_X86
+    AHTT_TARGET_AVX2 static void classify_avx2(const char *data, size_t size, acul::vector<uint32_t> &out)
+    {
+        classify<AVX2Kernel>(data, size, out);
+    }
+
+    static void classify_sse2(const char *data, size_t size, acul::vector<uint32_t> &out)
+    {
+        classify<SSE2Kernel>(data, size, out);
+    }
+#else
+    static void classify_scalar(const char *data, size_t size, acul::vector<uint32_t> &out)
+    {
+        for (size_t i = 0; i < size; ++i)
+            if (is_structural(data + i, data + size)) out.push_back(static_cast<uint32_t>(i));
+    }
+#endif
+
+    static ClassifyFn select_classifier()
+    {
+#if AHTT_SIMD_X86
+        return simd::has_avx2() ? classify_avx2 : classify_sse2;
+#else
+        return classify_scalar;
+#endif
+    }
+
+    void StructuralIndex::build(acul::string_view s)
+    {
+        static const ClassifyFn classify_fn = select_classifier();
+        _data = s.data();
+        _offsets.clear();
+        classify_fn(s.data(), s.size(), _offsets);
+        _offsets.push_back(static_cast<uint32_t>(s.size()));
+    }
+
+    const uint32_t *StructuralIndex::seek(const char *p) const
+    {
+        return &*std::lower_bound(_offsets.begin(), _offsets.end(), static_cast<uint32_t>(p - _data));
+    }
+
+    const char *StructuralIndex::match_interp(const char *p, const char *end) const
+    {
+        int depth = 1;
+        char quote = 0;
+        for (const uint32_t *it = seek(p);; ++it)
+        {
+            const char *s = at(it);
+            if (s >= end) return end;
+            if (quote)
+            {
+                if (*s == '\\')
+                {
+                    if (escapes_next(it, end)) ++it;
+                }
+                else if (*s == quote)
+                    quote = 0;
+            }
+            else if (*s == '{')
+                ++depth;
+            else if (*s == '}')
+            {
+                if (--depth == 0) return s;
+            }
+            else if (*s == '\'' || *s == '"')
+                quote = *s;
+        }
+    }
+
+    const char *StructuralIndex::match_gettext(const char *p, const char *end) const
+    {
+        int depth = 1;
+        char quote = 0;
+        for (const uint32_t *it = seek(p);; ++it)
+        {
+            const char *s = at(it);
+            if (s >= end) return end;
+            if (quote)
+            {
+                if (*s == '\\')
+                {
+                    if (escapes_next(it, end)) ++it;
+                }
+                else if (*s == quote)
+                    quote = 0;
+            }
+            else if (*s == '(')
+                ++depth;
+            else if (*s == ')')
+            {
+                if (--depth == 0) return s;
+            }
+            else if (*s == '#' && s + 1 < end)
+            {
+                const char *close = match_interp(s + 2, end);
+                if (close == end) return end;
+                it = seek(close);
+            }
+            else if (*s == '\'' || *s == '"')
+                quote = *s;
+        }
+    }
+
+    const char *StructuralIndex::match_quote(const char *p, const char *end, char q) const
+    {
+        for (const uint32_t *it = seek(p);; ++it)
+        {
+            const char *s = at(it);
+            if (s >= end) return end;
+            if (*s == '\\')
+            {
+                if (escapes_next(it, end)) ++it;
+            }
+            else if (*s == q)
+                return s;
+        }
+    }
+
+    bool StructuralIndex::has_expr(const char *p, const char *end) const
+    {
+        for (const uint32_t *it = seek(p);; ++it)
+        {
+            const char *s = at(it);
+            if (s + 1 >= end) return false;
+            if (*s == '#' || *s == '_') return true;
+        }
+    }
+} // namespace ahtt
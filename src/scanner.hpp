@@ -0,0 +1,48 @@
+#pragma once
+
+#include <acul/string/string_view.hpp>
+#include <acul/vector.hpp>
+#include <cstdint>
+
+namespace ahtt
+{
+    // Offsets of the bytes that can change quote, escape or nesting state in a head or text run: quotes,
+    // '\', parentheses, braces and the first byte of "#{" and "_(". They are classified a block at a time
+    // with SIMD compares, then the parsers step from one structural byte to the next instead of
+    // re-scanning every byte of the run.
+    class StructuralIndex
+    {
+    public:
+        StructuralIndex() = default;
+        explicit StructuralIndex(acul::string_view s) { build(s); }
+
+        void build(acul::string_view s);
+
+        // First structural byte at or after `p`. The list ends with the offset of the data end.
+        const uint32_t *seek(const char *p) const;
+        const char *at(const uint32_t *it) const { return _data + *it; }
+
+        // Whether the byte escaped by the '\' at `it` lies before `end` and is structural itself, so the
+        // walk has to step over it.
+        bool escapes_next(const uint32_t *it, const char *end) const
+        {
+            return at(it) + 1 < end && it[1] == it[0] + 1;
+        }
+
+        // `p` follows "#{"; returns the matching '}', skipping quoted text, or `end` if it is unclosed.
+        const char *match_interp(const char *p, const char *end) const;
+
+        // `p` follows "_("; returns the matching ')', skipping quoted text and interpolations, or `end`.
+        const char *match_gettext(const char *p, const char *end) const;
+
+        // `p` follows the opening quote `q`; returns the closing one or `end`.
+        const char *match_quote(const char *p, const char *end, char q) const;
+
+        // Whether [p, end) contains "#{" or "_(".
+        bool has_expr(const char *p, const char *end) const;
+
+    private:
+        const char *_data = nullptr;
+        acul::vector<uint32_t> _offsets;
+    };
+} // namespace ahtt
@@ -0,0 +1,226 @@
+#include "server.hpp"
+#include <acul/log.hpp>
+#include <filesystem>
+#include "worker_pool.hpp"
+
+#ifndef _WIN32
+    #include <cerrno>
+    #include <csignal>
+    #include <cstring>
+    #include <poll.h>
+    #include <sys/socket.h>
+    #include <sys/time.h>
+    #include <sys/un.h>
+    #include <unistd.h>
+#endif
+
+#ifndef MSG_NOSIGNAL
+    #define MSG_NOSIGNAL 0
+#endif
+
+// Request: u32 field count followed by u32-length-prefixed fields (input, output, dep-file, base-dir).
+// Response: u8 status (0 on success) followed by a u32-length-prefixed error message.
+#define AHTT_REQUEST_FIELDS 4
+#define AHTT_MAX_FIELD_SIZE 65536
+// Seconds a client may stall while sending its request or receiving the response before it is dropped.
+#define AHTT_CLIENT_TIMEOUT 10
+
+namespace ahtt
+{
+#ifndef _WIN32
+    static volatile sig_atomic_t g_stop = 0;
+
+    static void on_signal(int) { g_stop = 1; }
+
+    static bool send_all(int fd, const void *data, size_t size)
+    {
+        auto *p = static_cast<const char *>(data);
+        while (size > 0)
+        {
+            ssize_t n = ::send(fd, p, size, MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            p += n;
+            size -= static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    static bool recv_all(int fd, void *data, size_t size)
+    {
+        auto *p = static_cast<char *>(data);
+        while (size > 0)
+        {
+            ssize_t n = ::recv(fd, p, size, 0);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            p += n;
+            size -= static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    static bool send_field(int fd, acul::string_view field)
+    {
+        uint32_t len = static_cast<uint32_t>(field.size());
+        return send_all(fd, &len, sizeof(len)) && send_all(fd, field.data(), field.size());
+    }
+
+    static bool recv_field(int fd, acul::string &field)
+    {
+        uint32_t len;
+        if (!recv_all(fd, &len, sizeof(len)) || len > AHTT_MAX_FIELD_SIZE) return false;
+        field.resize(len);
+        return len == 0 || recv_all(fd, field.data(), len);
+    }
+
+    static bool make_address(const acul::path &socket_path, sockaddr_un &addr)
+    {
+        const auto &s = socket_path.str();
+        if (s.size() >= sizeof(addr.sun_path)) return false;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        memcpy(addr.sun_path, s.c_str(), s.size() + 1);
+        return true;
+    }
+
+    // Bounds every recv and send on an accepted socket, so a stalled client neither pins a worker nor
+    // keeps the server from shutting down.
+    static void set_client_timeouts(int fd)
+    {
+        timeval tv{AHTT_CLIENT_TIMEOUT, 0};
+        ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        ::setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    }
+
+    static void handle_client(int fd, const Session &session)
+    {
+        uint32_t count = 0;
+        acul::string fields[AHTT_REQUEST_FIELDS];
+        bool ok = recv_all(fd, &count, sizeof(count)) && count == AHTT_REQUEST_FIELDS;
+        for (size_t i = 0; ok && i < AHTT_REQUEST_FIELDS; ++i) ok = recv_field(fd, fields[i]);
+        if (!ok)
+        {
+            LOG_WARN("Malformed request");
+            ::close(fd);
+            return;
+        }
+
+        Job job{acul::path(fields[0]), fields[1], fields[2]};
+        Session request_session = session;
+        request_session.base_dir = acul::path(fields[3]);
+
+        uint8_t status = 0;
+        acul::string error;
+        try
+        {
+            IOInfo io;
+            transpile(job, request_session, io);
+        }
+        catch (const std::exception &e)
+        {
+            LOG_ERROR("%s: %s", job.input.str().c_str(), e.what());
+            status = 1;
+            error = e.what();
+        }
+        if (send_all(fd, &status, sizeof(status))) send_field(fd, error);
+        ::close(fd);
+    }
+
+    void serve(const acul::path &socket_path, const Session &session, size_t threads)
+    {
+        sockaddr_un addr;
+        if (!make_address(socket_path, addr))
+            throw acul::runtime_error(acul::format("Socket path is too long: %s", socket_path.str().c_str()));
+
+        int listen_fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listen_fd < 0) throw acul::runtime_error("Failed to create socket");
+        ::unlink(addr.sun_path);
+        if (::bind(listen_fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 || ::listen(listen_fd, 64) != 0)
+        {
+            ::close(listen_fd);
+            throw acul::runtime_error(acul::format("Failed to listen on %s", socket_path.str().c_str()));
+        }
+
+        g_stop = 0;
+        std::signal(SIGINT, on_signal);
+        std::signal(SIGTERM, on_signal);
+        LOG_INFO("Listening on %s", socket_path.str().c_str());
+
+        {
+            WorkerPool pool(threads);
+            Session pool_session = session;
+            pool_session.pool = &pool;
+            while (!g_stop)
+            {
+                pollfd pfd{listen_fd, POLLIN, 0};
+                int r = ::poll(&pfd, 1, 250);
+                if (r <= 0) continue;
+                int fd = ::accept(listen_fd, nullptr, nullptr);
+                if (fd < 0) continue;
+                set_client_timeouts(fd);
+                pool.submit([fd, &pool_session] { handle_client(fd, pool_session); });
+            }
+            pool.wait();
+        }
+
+        ::close(listen_fd);
+        ::unlink(addr.sun_path);
+        LOG_INFO("Server stopped");
+    }
+
+    bool request_transpile(const acul::path &socket_path, const Job &job, const acul::path &base_dir,
+                           acul::string &error)
+    {
+        sockaddr_un addr;
+        if (!make_address(socket_path, addr))
+        {
+            error = acul::format("Socket path is too long: %s", socket_path.str().c_str());
+            return false;
+        }
+
+        int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0 || ::connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0)
+        {
+            if (fd >= 0) ::close(fd);
+            error = acul::format("Failed to connect to %s", socket_path.str().c_str());
+            return false;
+        }
+
+        // The server has its own working directory, so relative paths are resolved here.
+        auto absolute = [](const acul::string &p) -> acul::string {
+            if (p.empty()) return p;
+            std::error_code ec;
+            auto abs = std::filesystem::absolute(std::filesystem::path(p.c_str()), ec);
+            return ec ? p : acul::string(abs.string().c_str());
+        };
+
+        acul::string base = base_dir.str().empty() ? acul::string(std::filesystem::current_path().string().c_str())
+                                                   : absolute(base_dir.str());
+        uint32_t count = AHTT_REQUEST_FIELDS;
+        uint8_t status = 1;
+        bool ok = send_all(fd, &count, sizeof(count));
+        ok = ok && send_field(fd, absolute(job.input.str())) && send_field(fd, absolute(job.output));
+        ok = ok && send_field(fd, absolute(job.dep_file)) && send_field(fd, base);
+        ok = ok && recv_all(fd, &status, sizeof(status)) && recv_field(fd, error);
+        ::close(fd);
+        if (!ok)
+        {
+            error = "Connection to the server was lost";
+            return false;
+        }
+        return status == 0;
+    }
+#else
+    void serve(const acul::path &, const Session &, size_t)
+    {
+        throw acul::runtime_error("Server mode is only supported on POSIX systems");
+    }
+
+    bool request_transpile(const acul::path &, const Job &, const acul::path &, acul::string &error)
+    {
+        error = "Server mode is only supported on POSIX systems";
+        return false;
+    }
+#endif
+} // namespace ahtt
@@ -0,0 +1,14 @@
+#pragma once
+
+#include "driver.hpp"
+
+namespace ahtt
+{
+    // Serves transpile requests on a Unix domain socket until SIGINT/SIGTERM. Every request reuses the
+    // parse cache of `session`, so layouts and includes stay warm between requests.
+    void serve(const acul::path &socket_path, const Session &session, size_t threads);
+
+    // Sends `job` to a running server and waits for it to finish. On failure returns false and fills `error`.
+    bool request_transpile(const acul::path &socket_path, const Job &job, const acul::path &base_dir,
+                           acul::string &error);
+} // namespace ahtt
@@ -0,0 +1,62 @@
+#pragma once
+
+// Shared by the vectorised scanners. AVX2 code is compiled per function with AHTT_TARGET_AVX2 and only
+// called after has_avx2(), so the build itself needs no -mavx2 or -march flags. Generic loops over a
+// kernel are AHTT_ALWAYS_INLINE so that they take on the target of the entry point instantiating them.
+#if defined(__x86_64__) || defined(_M_X64) || defined(__SSE2__)
+    #define AHTT_SIMD_X86 1
+    #include <immintrin.h>
+    #ifdef _MSC_VER
+        #include <intrin.h>
+        #define AHTT_TARGET_AVX2
+    #else
+        #define AHTT_TARGET_AVX2 __attribute__((target("avx2")))
+    #endif
+#else
+    #define AHTT_SIMD_X86 0
+#endif
+
+#ifdef _MSC_VER
+    #define AHTT_ALWAYS_INLINE __forceinline
+#else
+    #define AHTT_ALWAYS_INLINE __attribute__((always_inline)) inline
+#endif
+
+namespace ahtt::simd
+{
+#if AHTT_SIMD_X86
+    inline unsigned ctz32(unsigned mask)
+    {
+    #ifdef _MSC_VER
+        unsigned long index;
+        _BitScanForward(&index, mask);
+        return index;
+    #else
+        return static_cast<unsigned>(__builtin_ctz(mask));
+    #endif
+    }
+
+    inline bool detect_avx2()
+    {
+    #ifdef _MSC_VER
+        int info[4];
+        __cpuid(info, 0);
+        if (info[0] < 7) return false;
+        __cpuid(info, 1);
+        bool osxsave = (info[2] & (1 << 27)) != 0;
+        if (!osxsave || (_xgetbv(0) & 0x6) != 0x6) return false;
+        __cpuidex(info, 7, 0);
+        return (info[1] & (1 << 5)) != 0;
+    #else
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2");
+    #endif
+    }
+
+    inline bool has_avx2()
+    {
+        static const bool supported = detect_avx2();
+        return supported;
+    }
+#endif
+} // namespace ahtt::simd
@@ -9,35 +9,111 @@
 
 namespace ahtt
 {
-    static inline void push_expr(NodeList &ast, const Pos &pos, acul::string_view sv)
+    static void write_escaped(acul::string &out, acul::string_view s)
+    {
+        const char *run = s.data();
+        const char *end = s.data() + s.size();
+        for (const char *p = run; p < end; ++p)
+        {
+            const char *esc;
+            switch (*p)
+            {
+                case '\\':
+                    esc = "\\\\";
+                    break;
+                case '\"':
+                    esc = "\\\"";
+                    break;
+                case '\n':
+                    esc = "\\n";
+                    break;
+                case '\r':
+                    esc = "\\r";
+                    break;
+                case '\t':
+                    esc = "\\t";
+                    break;
+                default:
+                    continue;
+            }
+            out.append(run, p - run);
+            out.append(esc, 2);
+            run = p + 1;
+        }
+        out.append(run, end - run);
+    }
+
+    static inline void start_chain(CodeSink &sink)
+    {
+        if (sink.chain_open) return;
+        *sink.out += sink.indent;
+        *sink.out += sink.ss_out;
+        *sink.out += " << ";
+        sink.chain_open = true;
+        sink.chain_empty = true;
+    }
+
+    static void flush_literal(CodeSink &sink)
+    {
+        if (sink.literal.empty()) return;
+        start_chain(sink);
+        if (!sink.chain_empty) *sink.out += " << ";
+        *sink.out += "ahtt::lit(\"";
+        write_escaped(*sink.out, sink.literal);
+        *sink.out += "\")";
+        sink.chain_empty = false;
+        sink.literal.clear();
+    }
+
+    // Closes the current `ss << ...;` statement, if any, so that a statement can follow.
+    static void end_chain(CodeSink &sink)
+    {
+        flush_literal(sink);
+        if (!sink.chain_open) return;
+        *sink.out += ";\n";
+        sink.chain_open = false;
+    }
+
+    static inline void put_literal(CodeSink &sink, acul::string_view sv)
     {
         if (sv.empty()) return;
-        auto en = acul::make_unique<ExprNode>();
-        en->pos = pos;
-        en->expr.assign(sv.data(), sv.size());
-        ast.push_back(std::move(en));
+        sink.literal += sv;
+        sink.literal_bytes += sv.size();
+        ++sink.emitted;
+    }
+
+    static void put_expr(CodeSink &sink, acul::string_view expr)
+    {
+        flush_literal(sink);
+        start_chain(sink);
+        *sink.out += sink.chain_empty ? "(" : " << (";
+        *sink.out += expr;
+        *sink.out += ')';
+        sink.chain_empty = false;
+        ++sink.emitted;
     }
 
-    void push_text_to_ast(NodeList &ast, HtmlIR &ir, HTMLNode *node)
+    static void put_statement(CodeSink &sink, acul::string_view code)
     {
-        for (auto &seg : ir.content.segs)
+        end_chain(sink);
+        *sink.out += sink.indent;
+        *sink.out += code;
+        *sink.out += '\n';
+        ++sink.emitted;
+    }
+
+    static void put_value(CodeSink &sink, const HtmlValue &v)
+    {
+        for (const auto &seg : v.segs)
         {
             if (seg.kind == HtmlSegment::Literal)
-            {
-                if (!seg.sv.empty())
-                {
-                    auto tn = acul::make_unique<TextNode>();
-                    tn->pos = node->pos;
-                    tn->text = acul::string(seg.sv);
-                    ast.push_back(std::move(tn));
-                }
-            }
-            else if (seg.kind == HtmlSegment::Expr)
-                if (!seg.sv.empty()) push_expr(ast, node->pos, seg.sv);
+                put_literal(sink, seg.sv);
+            else if (!seg.sv.empty())
+                put_expr(sink, seg.sv);
         }
     }
 
-    void push_doctype_to_ast(NodeList &ast, HtmlIR &ir, HTMLNode *node)
+    static void put_doctype(CodeSink &sink, const HtmlIR &ir)
     {
         static acul::hashmap<acul::string_view, const char *> builtin{
             {"html", "<!DOCTYPE html>"},
@@ -59,111 +135,55 @@ namespace ahtt
         auto trimmed = acul::trim(ir.content.segs.front().sv);
         auto it = builtin.find(trimmed.data());
         if (it != builtin.end())
-        {
-            auto tn = acul::make_unique<TextNode>();
-            tn->pos = node->pos;
-            tn->text = it->second;
-            ast.push_back(std::move(tn));
-        }
+            put_literal(sink, it->second);
         else
-        {
-            ir.tag = "!DOCTYPE";
-            push_text_to_ast(ast, ir, node);
-        }
-    }
-
-    static inline void flush_text(NodeList &ast, acul::stringstream &ss, const Pos &pos, bool &has_buf)
-    {
-        if (!has_buf) return;
-        auto tn = acul::make_unique<TextNode>();
-        tn->pos = pos;
-        tn->text = ss.str();
-        ast.push_back(std::move(tn));
-        ss.clear();
-        has_buf = false;
-    }
-
-    static inline void put_sv(acul::stringstream &ss, acul::string_view sv, bool &has_buf)
-    {
-        if (!sv.empty())
-        {
-            ss.write(sv.data(), (std::streamsize)sv.size());
-            has_buf = true;
-        }
-    }
-
-    static void emit_value(NodeList &ast, acul::stringstream &ss, HTMLNode *node, bool &has_buf, const HtmlValue &v)
-    {
-        for (const auto &seg : v.segs)
-        {
-            if (seg.kind == HtmlSegment::Literal) { put_sv(ss, seg.sv, has_buf); }
-            else
-            {
-                flush_text(ast, ss, node->pos, has_buf);
-                if (!seg.sv.empty()) push_expr(ast, node->pos, seg.sv);
-            }
-        }
+            put_value(sink, ir.content);
     }
 
-    static void emit_open_tag(NodeList &ast, HtmlIR &ir, HTMLNode *node)
+    static void put_open_tag(CodeSink &sink, const HtmlIR &ir)
     {
-        acul::stringstream ss;
-        bool has_buf = false;
-
-        ss << '<';
-        put_sv(ss, ir.tag, has_buf);
+        put_literal(sink, "<");
+        put_literal(sink, ir.tag);
 
         if (!ir.id.empty())
         {
-            ss << " id=\"";
-            has_buf = true;
-            emit_value(ast, ss, node, has_buf, ir.id);
-            ss << '"';
-            has_buf = true;
+            put_literal(sink, " id=\"");
+            put_value(sink, ir.id);
+            put_literal(sink, "\"");
         }
 
         if (!ir.classes.empty())
         {
-            ss << " class=\"";
-            has_buf = true;
+            put_literal(sink, " class=\"");
             for (size_t i = 0; i < ir.classes.size(); ++i)
             {
-                emit_value(ast, ss, node, has_buf, ir.classes[i]);
-                if (i + 1 < ir.classes.size())
-                {
-                    ss << ' ';
-                    has_buf = true;
-                }
+                put_value(sink, ir.classes[i]);
+                if (i + 1 < ir.classes.size()) put_literal(sink, " ");
             }
-            ss << '"';
-            has_buf = true;
+            put_literal(sink, "\"");
         }
 
         for (const auto &attr : ir.attrs)
         {
-            ss << ' ';
-            has_buf = true;
-            emit_value(ast, ss, node, has_buf, attr.name);
+            put_literal(sink, " ");
+            put_value(sink, attr.name);
             if (!attr.value.empty())
             {
-                ss << '=';
-                has_buf = true;
-                emit_value(ast, ss, node, has_buf, attr.value);
+                put_literal(sink, "=");
+                put_value(sink, attr.value);
             }
         }
 
-        ss << '>';
-        has_buf = true;
-        flush_text(ast, ss, node->pos, has_buf);
+        put_literal(sink, ">");
     }
 
-    static void emit_ir_chain(NodeList &ast, HtmlIR &ir, HTMLNode *node)
+    static void put_ir_chain(CodeSink &sink, const HtmlIR &ir)
     {
-        emit_open_tag(ast, ir, node);
+        put_open_tag(sink, ir);
         if (ir.next)
-            emit_ir_chain(ast, *ir.next, node);
-        else if (!ir.content.empty())
-            push_text_to_ast(ast, ir, node);
+            put_ir_chain(sink, *ir.next);
+        else
+            put_value(sink, ir.content);
     }
 
     static inline bool is_void_tag(acul::string_view t)
@@ -202,73 +222,45 @@ namespace ahtt
         }
     }
 
-    static void collect_chain_tags(const HtmlIR &ir, acul::vector<acul::string_view> &out)
-    {
-        const HtmlIR *p = &ir;
-        while (p)
-        {
-            out.push_back(p->tag);
-            p = p->next.get();
-        }
-    }
-
-    static inline void emit_close_tag(NodeList &ast, HTMLNode *node, acul::string_view tag)
-    {
-        auto tn = acul::make_unique<TextNode>();
-        tn->pos = node->pos;
-        tn->text = acul::format("</%.*s>", (int)tag.size(), tag.data());
-        ast.push_back(std::move(tn));
-    }
-
-    static void push_plain_text(NodeList &ast, const Pos &pos, acul::string_view raw)
-    {
-        HtmlValue v = parse_segments_full(raw);
-
-        acul::stringstream ss;
-        bool has_buf = false;
-
-        for (const auto &seg : v.segs)
-        {
-            if (seg.kind == HtmlSegment::Literal)
-                put_sv(ss, seg.sv, has_buf);
-            else
-            {
-                flush_text(ast, ss, pos, has_buf);
-                push_expr(ast, pos, seg.sv);
-            }
-        }
-        flush_text(ast, ss, pos, has_buf);
-    }
-
-    int Translator::build_html(NodeList &ast, HTMLNode *node)
+    void Translator::build_html(HTMLNode *node)
     {
         HtmlIR ir;
-        const char *pos = node->head.c_str();
-        parse_to_html_ir(node, ir, pos);
+        const char *pos = node->head.data();
+        parse_to_html_ir(node, ir, pos, _scan);
 
         if (!_doctype && ir.tag == "doctype" && ir.content.segs.size() == 1)
         {
             _doctype = node;
-            push_doctype_to_ast(ast, ir, node);
-            return AHTT_PARSE_DEFAULT;
+            put_doctype(*_sink, ir);
+            return;
         }
 
-        emit_ir_chain(ast, ir, node);
-        int flags = parse_tokens(node->children, ast);
+        put_ir_chain(*_sink, ir);
+        translate(node->children);
 
         acul::vector<acul::string_view> opened;
         opened.reserve(4);
-        collect_chain_tags(ir, opened);
+        for (const HtmlIR *p = &ir; p; p = p->next.get()) opened.push_back(p->tag);
         for (size_t i = opened.size(); i-- > 0;)
-            if (!is_void_tag(opened[i])) emit_close_tag(ast, node, opened[i]);
-        return flags;
+        {
+            if (is_void_tag(opened[i])) continue;
+            put_literal(*_sink, "</");
+            put_literal(*_sink, opened[i]);
+            put_literal(*_sink, ">");
+        }
+    }
+
+    void Translator::translate_text(acul::string_view raw)
+    {
+        HtmlValue v = parse_segments_full(raw, _scan);
+        put_value(*_sink, v);
     }
 
     static inline bool is_ident_start(char c) { return std::isalpha(static_cast<unsigned char>(c)) || c == '_'; }
 
     void Translator::build_external_node(ExternalNode *current)
     {
-        _external = acul::make_unique<ExternalNode>();
+        _external = _arena.make<ExternalNode>();
         _external->pos = current->pos;
         _external->is_struct = current->is_struct;
 
@@ -276,24 +268,25 @@ namespace ahtt
         {
             if (!child || child->kind() != INode::Kind::code) continue;
 
-            auto *cn = static_cast<CodeNode *>(child.get());
-            acul::string trimmed = acul::trim_start(cn->code);
+            auto *cn = static_cast<CodeNode *>(child);
+            acul::string_view trimmed = trim_start_view(cn->code);
             if (trimmed.empty())
             {
-                child.reset();
+                child = nullptr;
                 continue;
             }
 
             if (acul::starts_with(trimmed, "#include"))
             {
-                _includes_map.emplace(acul::string(trimmed));
-                child.reset();
+                add_include(acul::string(trimmed));
+                child = nullptr;
                 continue;
             }
 
             if (_external->is_struct)
             {
-                _external->children.emplace_back(std::move(child));
+                _external->children.push_back(child);
+                child = nullptr;
                 continue;
             }
 
@@ -301,16 +294,118 @@ namespace ahtt
             {
                 size_t end = acul::find_last_of(trimmed.data(), trimmed.size(), ';');
                 if (end == trimmed.npos) end = trimmed.size();
-                auto ncn = acul::make_unique<CodeNode>();
+                auto ncn = _arena.make<CodeNode>();
                 ncn->pos = cn->pos;
                 ncn->code = trimmed.substr(0, end);
-                _external->children.emplace_back(std::move(ncn));
+                _external->children.push_back(ncn);
             }
-            child.reset();
+            child = nullptr;
+        }
+    }
+
+    void Translator::translate_into(CodeSink &sink, const NodeList &nodes)
+    {
+        CodeSink *parent = _sink;
+        _sink = &sink;
+        translate(nodes);
+        end_chain(sink);
+        _sink = parent;
+    }
+
+    void Translator::translate_code(CodeNode *node)
+    {
+        auto trimmed = trim_start_view(node->code);
+        if (acul::starts_with(trimmed, "#include"))
+        {
+            add_include(acul::string(trimmed));
+            return;
+        }
+
+        CodeSink &sink = *_sink;
+        put_statement(sink, node->code);
+
+        // The braces are dropped again if none of the children generated anything.
+        acul::string &out = *sink.out;
+        size_t mark = out.size();
+        out += sink.indent;
+        out += "{\n";
+        CodeSink inner{sink.out, sink.ss_out, sink.indent + INDENT4};
+        translate_into(inner, node->children);
+        if (inner.emitted == 0)
+            out.resize(mark);
+        else
+        {
+            out += sink.indent;
+            out += "}\n";
         }
     }
 
-    int Translator::parse_node(INode *node, NodeList &ast)
+    void Translator::translate_mixin_decl(MixinDecl *decl)
+    {
+        // Only the first declaration of a name is generated, but every one is walked for its includes.
+        Mixin *mixin = &_mixins[_mixins_map.find(decl->name)->second];
+        if (mixin->decl != decl || mixin->translated) mixin = nullptr;
+
+        CodeSink sink{mixin ? &mixin->body : &_discard, "ss", INDENT16};
+        translate_into(sink, decl->children);
+        if (mixin)
+            mixin->translated = true;
+        else
+            _discard.clear();
+    }
+
+    void Translator::translate_mixin_call(MixinCall *call)
+    {
+        CodeSink &sink = *_sink;
+        auto it = _mixins_map.find(call->name);
+        if (it == _mixins_map.end() || !_mixins[it->second].has_block)
+        {
+            if (it == _mixins_map.end())
+            {
+                LOG_WARN("mixin [%s] was not declared", call->name.c_str());
+                ++sink.emitted;
+            }
+            CodeSink discard{&_discard, "ss", ""};
+            translate_into(discard, call->children);
+            _discard.clear();
+            if (it == _mixins_map.end()) return;
+        }
+
+        end_chain(sink);
+        ++sink.emitted;
+        acul::string &out = *sink.out;
+        out += sink.indent;
+        out += "mixins::";
+        out += call->name;
+        out += "(ss";
+
+        if (_mixins[it->second].has_block)
+        {
+            size_t mark = out.size();
+            out += ", [&](auto& __blk_ss) {\n";
+            CodeSink block{sink.out, "__blk_ss", sink.indent + INDENT4};
+            translate_into(block, call->children);
+            if (block.emitted == 0)
+            {
+                out.resize(mark);
+                out += ", [](auto&) {}";
+            }
+            else
+            {
+                out += sink.indent;
+                out += "}";
+            }
+        }
+
+        for (const auto &arg : call->args)
+        {
+            out += ", ";
+            out += arg;
+        }
+        out += ");\n";
+    }
+
+    void Translator::translate_node(INode *node)
     {
         switch (node->kind())
         {
@@ -318,234 +413,489 @@ namespace ahtt
                 build_external_node(static_cast<ExternalNode *>(node));
                 break;
             case INode::Kind::html:
-                return build_html(ast, static_cast<HTMLNode *>(node));
+                build_html(static_cast<HTMLNode *>(node));
+                break;
             case INode::Kind::text:
-            {
-                auto tn = static_cast<TextNode *>(node);
-                push_plain_text(ast, tn->pos, tn->text);
+                translate_text(static_cast<TextNode *>(node)->text);
                 break;
-            }
             case INode::Kind::text_group:
             {
                 auto *tgn = static_cast<TextGroupNode *>(node);
-                acul::string buf;
+                _text.clear();
                 for (size_t i = 0; i < tgn->text_nodes.size(); ++i)
                 {
-                    const auto *tn = tgn->text_nodes[i].get();
-                    buf += tn->text;
-                    if (i + 1 < tgn->text_nodes.size()) buf.push_back('\n');
+                    _text += tgn->text_nodes[i]->text;
+                    if (i + 1 < tgn->text_nodes.size()) _text.push_back('\n');
                 }
-                push_plain_text(ast, tgn->pos, buf);
+                translate_text(_text);
                 break;
             }
-
             case INode::Kind::code:
-            {
-                auto cn = static_cast<CodeNode *>(node);
-                auto trimmed = acul::trim_start(cn->code);
-                if (acul::starts_with(trimmed, "#include"))
-                {
-                    _includes_map.emplace(std::move(trimmed));
-                    break;
-                }
-                else
-                {
-                    auto &sv = cn->code;
-                    auto ncn = acul::make_unique<CodeNode>();
-                    ncn->pos = cn->pos;
-                    ncn->code.assign(sv.data(), sv.size());
-                    parse_tokens(cn->children, ncn->children);
-                    ast.push_back(std::move(ncn));
-                }
+                translate_code(static_cast<CodeNode *>(node));
                 break;
-            }
             case INode::Kind::expr:
-                ast.push_back(node->clone());
+                put_expr(*_sink, static_cast<ExprNode *>(node)->expr);
                 break;
             case INode::Kind::mixin_decl:
-            {
-                auto m = acul::make_unique<MixinDecl>();
-                parse_mixin(static_cast<MixinDecl *>(node), m.get());
-                _mixins_map.emplace(m->name, std::move(m));
+                translate_mixin_decl(static_cast<MixinDecl *>(node));
                 break;
-            }
             case INode::Kind::mixin_call:
-            {
-                auto m = acul::make_unique<MixinCall>();
-                parse_mixin(static_cast<MixinDecl *>(node), m.get());
-                ast.push_back(std::move(m));
+                translate_mixin_call(static_cast<MixinCall *>(node));
                 break;
-            }
             case INode::Kind::block:
-            {
-                auto *bn = static_cast<BlockNode *>(node);
-                auto en = acul::make_unique<CodeNode>();
-                en->pos = bn->pos;
-                en->code = "std::forward<Block>(block)(ss);";
-                ast.push_back(std::move(en));
-                return AHTT_PARSE_BLOCK_ADDED;
-            }
+                put_statement(*_sink, "std::forward<Block>(block)(ss);");
+                break;
             default:
                 break;
         }
-        return AHTT_PARSE_DEFAULT;
     }
 
-    static acul::stringstream &write_mixin_signature(acul::stringstream &ss, MixinDecl *decl, bool has_block)
+    // Whether a mixin body passes control to its caller's block. Only html nesting counts, as for
+    // the generated code a block inside a statement or another mixin belongs to that one instead.
+    static bool has_block_slot(const NodeList &nodes)
     {
-        if (has_block) ss << INDENT12 "template <class Block>\n";
-        ss << INDENT12 "inline void " << decl->name << "(acul::stringstream& ss";
-        if (has_block) ss << ", Block&& block";
-        for (const auto &arg : decl->args) ss << ", " << arg;
-        ss << ')';
-        return ss;
+        for (auto *node : nodes)
+        {
+            if (node->kind() == INode::Kind::block) return true;
+            if (node->kind() == INode::Kind::html && has_block_slot(static_cast<HTMLNode *>(node)->children))
+                return true;
+        }
+        return false;
     }
 
-    acul::stringstream &Translator::write_node_list(acul::stringstream &ss, const NodeList &nodes, const char *ss_out,
-                                                    const char *indent)
+    // Mixins are registered in the order the old two-pass translation finished them, so calls can be
+    // generated before their declaration has been reached.
+    void Translator::collect_mixins(const NodeList &nodes)
     {
-        auto escape_cpp_string = [](acul::string_view s) -> acul::string {
-            acul::string out;
-            out.reserve(s.size() + 8);
-            for (char c : s)
+        for (auto *node : nodes)
+        {
+            switch (node->kind())
             {
-                switch (c)
+                case INode::Kind::code:
                 {
-                    case '\\':
-                        out.push_back('\\');
-                        out.push_back('\\');
-                        break;
-                    case '\"':
-                        out.push_back('\\');
-                        out.push_back('\"');
-                        break;
-                    case '\n':
-                        out.push_back('\\');
-                        out.push_back('n');
-                        break;
-                    case '\r':
-                        out.push_back('\\');
-                        out.push_back('r');
-                        break;
-                    case '\t':
-                        out.push_back('\\');
-                        out.push_back('t');
-                        break;
-                    default:
-                        out.push_back(c);
-                        break;
+                    auto *cn = static_cast<CodeNode *>(node);
+                    if (!acul::starts_with(trim_start_view(cn->code), "#include")) collect_mixins(cn->children);
+                    break;
                 }
+                case INode::Kind::html:
+                case INode::Kind::mixin_call:
+                    collect_mixins(static_cast<ParentNode *>(node)->children);
+                    break;
+                case INode::Kind::mixin_decl:
+                {
+                    auto *decl = static_cast<MixinDecl *>(node);
+                    collect_mixins(decl->children);
+                    if (_mixins_map.emplace(decl->name, _mixins.size()).second)
+                        _mixins.push_back({decl, has_block_slot(decl->children), false, {}});
+                    break;
+                }
+                default:
+                    break;
             }
-            return out;
-        };
+        }
+    }
+
+    void Translator::parse_tokens()
+    {
+        collect_mixins(_p.ast);
+        CodeSink render{&_body, "ss", INDENT12};
+        translate_into(render, _p.ast);
+        _body_literal_bytes = render.literal_bytes;
+    }
+
+    static acul::stringstream &write_mixin_signature(acul::stringstream &ss, const MixinDecl *decl, bool has_block)
+    {
+        ss << (has_block ? INDENT12 "template <class Stream, class Block>\n" : INDENT12 "template <class Stream>\n");
+        ss << INDENT12 "inline void " << decl->name << "(Stream& ss";
+        if (has_block) ss << ", Block&& block";
+        for (const auto &arg : decl->args) ss << ", " << arg;
+        ss << ')';
+        return ss;
+    }
+
+    // Shared by every generated header, hence the guard. render_to() streams through sink_stream(), which
+    // hands acul::stringstream back as is and wraps any other sink. Literals are written as lit() so that a
+    // sink with append_static() can keep a reference to them instead of a copy.
+    static const char *sink_support = R"(#ifndef AHTT_SINK_STREAM
+#define AHTT_SINK_STREAM
+#include <atomic>
+#include <charconv>
+#include <cstring>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#if __has_include(<memory_resource>)
+    #include <memory_resource>
+    #include <string>
+    #define AHTT_HAS_PMR 1
+#endif
+#ifndef _WIN32
+    #include <cerrno>
+    #include <climits>
+    #include <sys/uio.h>
+    #include <unistd.h>
+#endif
+
+namespace ahtt
+{
+    // A string literal of the generated code, alive for the whole program.
+    struct Literal
+    {
+        const char *data;
+        size_t size;
+    };
 
-        bool chain_open = false;
-        bool first_in_chain = false;
-        acul::string pending_text;
+    template <size_t N>
+    constexpr Literal lit(const char (&s)[N])
+    {
+        return {s, N - 1};
+    }
 
-        auto start_chain = [&] {
-            if (!chain_open)
+    inline acul::stringstream &operator<<(acul::stringstream &ss, Literal l)
+    {
+        ss.write(l.data, l.size);
+        return ss;
+    }
+
+    // Integers that to_chars() writes as a stream would. Character types and bool are left to the stream; the
+    // checks are nested so that sizeof never sees the function type of a manipulator.
+    template <class T>
+    constexpr bool is_plain_integer()
+    {
+        if constexpr (std::is_integral_v<T>)
+            return sizeof(T) > 1 && !std::is_same_v<T, wchar_t> && !std::is_same_v<T, char16_t> &&
+                   !std::is_same_v<T, char32_t>;
+        else
+            return false;
+    }
+
+    // Adapts a sink with append(const char *, size_t) to the << chains of the generated code. Strings, characters
+    // and numbers go straight to the sink. Anything else, manipulators included, goes to an acul::stringstream
+    // created on first use, and from then on so does all other output, so that formatting state set by a code
+    // line applies to the rest of the render as it would in a stream. finish() hands that output to the sink.
+    template <class Sink>
+    class SinkStream
+    {
+    public:
+        explicit SinkStream(Sink &out) : _out(out) {}
+
+        SinkStream &operator<<(Literal l)
+        {
+            if (_fmt)
+                *_fmt << l;
+            else if constexpr (requires { _out.append_static(l.data, l.size); })
+                _out.append_static(l.data, l.size);
+            else
+                _out.append(l.data, l.size);
+            return *this;
+        }
+
+        SinkStream &operator<<(const char *s) { return write(s, std::strlen(s)); }
+
+        SinkStream &operator<<(char c) { return write(&c, 1); }
+
+        SinkStream &write(const char *data, size_t size)
+        {
+            if (_fmt)
+                _fmt->write(data, size);
+            else
+                _out.append(data, size);
+            return *this;
+        }
+
+        template <class T>
+        SinkStream &operator<<(const T &value)
+        {
+            if constexpr (std::is_convertible_v<const T &, acul::string_view>)
             {
-                ss << indent << ss_out << " << ";
-                chain_open = true;
-                first_in_chain = true;
+                acul::string_view s = value;
+                write(s.data(), s.size());
             }
-        };
-        auto end_chain = [&] {
-            if (chain_open)
+            else if constexpr (is_plain_integer<T>() || std::is_floating_point_v<T>)
             {
-                ss << ";\n";
-                chain_open = false;
-                first_in_chain = false;
+                if (_fmt)
+                    *_fmt << value;
+                else
+                {
+                    // Without formatting state a stream writes integers in full and floats as %g would.
+                    char buf[32];
+                    std::to_chars_result r;
+                    if constexpr (std::is_floating_point_v<T>)
+                        r = std::to_chars(buf, buf + sizeof(buf), value, std::chars_format::general, 6);
+                    else
+                        r = std::to_chars(buf, buf + sizeof(buf), value);
+                    _out.append(buf, r.ptr - buf);
+                }
             }
-        };
-        auto append_text_seg = [&](acul::string_view lit) {
-            start_chain();
-            if (!first_in_chain) ss << " << ";
-            ss << '\"' << escape_cpp_string(lit) << '\"';
-            first_in_chain = false;
-        };
-        auto append_expr_seg = [&](acul::string_view expr) {
-            start_chain();
-            if (!first_in_chain) ss << " << (" << expr << ")";
-            first_in_chain = false;
-        };
-        auto flush_pending_text = [&] {
-            if (!pending_text.empty())
+            else
             {
-                append_text_seg(pending_text);
-                pending_text.clear();
+                if (!_fmt) _fmt = std::make_unique<acul::stringstream>();
+                *_fmt << value;
             }
+            return *this;
+        }
+
+        // Writes the output held by the formatting stream to the sink; render_to() calls it last.
+        void finish()
+        {
+            if (!_fmt) return;
+            auto s = _fmt->str();
+            _fmt.reset();
+            _out.append(s.data(), s.size());
+        }
+
+    private:
+        Sink &_out;
+        std::unique_ptr<acul::stringstream> _fmt;
+    };
+
+    template <class Sink>
+    inline SinkStream<Sink> sink_stream(Sink &out)
+    {
+        return SinkStream<Sink>(out);
+    }
+
+    inline acul::stringstream &sink_stream(acul::stringstream &out) { return out; }
+
+    template <class Sink>
+    inline void finish_stream(SinkStream<Sink> &ss)
+    {
+        ss.finish();
+    }
+
+    inline void finish_stream(acul::stringstream &) {}
+
+    // Running estimate of a template's output size, an exponentially weighted average of its recent renders.
+    // Updates from concurrent renders may be lost, which only makes the estimate lag.
+    class SizeHint
+    {
+    public:
+        constexpr explicit SizeHint(size_t initial) : _value(initial) {}
+
+        // Capacity to reserve: the estimate with a quarter of headroom for renders above the average.
+        size_t capacity() const
+        {
+            size_t v = _value.load(std::memory_order_relaxed);
+            return v + v / 4;
+        }
+
+        void update(size_t size)
+        {
+            size_t v = _value.load(std::memory_order_relaxed);
+            _value.store(v - v / 8 + size / 8, std::memory_order_relaxed);
+        }
+
+    private:
+        std::atomic<size_t> _value;
+    };
+
+    // Per-thread buffers reused by render(), so that once they have grown a render allocates only the string it
+    // returns. A buffer is taken for the duration of one render; nested renders take one each.
+    class PooledBuffer
+    {
+    public:
+        // Larger buffers are freed after use instead of being kept for the next render.
+        static constexpr size_t max_pooled = 1 << 20;
+
+        PooledBuffer()
+        {
+            auto &pool = free_list();
+            if (pool.empty()) return;
+            _buffer = std::move(pool.back());
+            pool.pop_back();
+        }
+
+        PooledBuffer(const PooledBuffer &) = delete;
+        PooledBuffer &operator=(const PooledBuffer &) = delete;
+
+        ~PooledBuffer()
+        {
+            if (_buffer.capacity() > max_pooled) return;
+            _buffer.clear();
+            free_list().push_back(std::move(_buffer));
+        }
+
+        acul::string &operator*() { return _buffer; }
+        acul::string *operator->() { return &_buffer; }
+
+    private:
+        acul::string _buffer;
+
+        static acul::vector<acul::string> &free_list()
+        {
+            thread_local acul::vector<acul::string> pool;
+            return pool;
+        }
+    };
+
+    // Counts the bytes written to it; render_to() into one measures the exact output size.
+    class SizeCounter
+    {
+    public:
+        void reserve(size_t) {}
+
+        void append(const char *, size_t size) { _size += size; }
+
+        size_t size() const { return _size; }
+
+    private:
+        size_t _size = 0;
+    };
+
+    // Output kept as a list of segments for writev(). Literals are referenced where they live; everything else,
+    // and literals too short to be worth a segment of their own, is copied into chunks owned by the list.
+    // clear() keeps the chunks, so a list reused between renders stops allocating once it has grown.
+    class SegmentList
+    {
+    public:
+        struct Segment
+        {
+            const char *data;
+            size_t size;
         };
 
-        for (const auto &n : nodes)
+        static constexpr size_t copy_below = 64;
+        static constexpr size_t chunk_size = 4096;
+
+        void reserve(size_t) {}
+
+        void append_static(const char *data, size_t size)
         {
-            switch (n->kind())
+            if (size < copy_below)
+                append(data, size);
+            else if (size)
             {
-                case INode::Kind::text:
-                {
-                    pending_text += static_cast<const TextNode &>(*n).text;
-                    break;
-                }
-                case INode::Kind::expr:
+                _segments.push_back({data, size});
+                _size += size;
+            }
+        }
+
+        void append(const char *data, size_t size)
+        {
+            if (!size) return;
+            if (_chunk == _chunks.size() || _used + size > _chunks[_chunk].size) next_chunk(size);
+            char *dst = _chunks[_chunk].data.get() + _used;
+            std::memcpy(dst, data, size);
+            if (!_segments.empty() && _segments.back().data + _segments.back().size == dst)
+                _segments.back().size += size;
+            else
+                _segments.push_back({dst, size});
+            _used += size;
+            _size += size;
+        }
+
+        const acul::vector<Segment> &segments() const { return _segments; }
+
+        // Total bytes of all segments.
+        size_t size() const { return _size; }
+
+        void clear()
+        {
+            _segments.clear();
+            _size = 0;
+            _chunk = 0;
+            _used = 0;
+        }
+
+        acul::string str() const
+        {
+            acul::string out;
+            out.reserve(_size);
+            for (const auto &s : _segments) out.append(s.data, s.size);
+            return out;
+        }
+
+#ifndef _WIN32
+        // Writes the bytes from `written` on to `fd`, resuming after partial writes, and advances `written` past
+        // everything sent. Returns false on a write error with errno set, e.g. EAGAIN on a non-blocking socket;
+        // calling again with the same `written` continues where it stopped.
+        bool write(int fd, size_t &written) const
+        {
+            constexpr size_t batch = IOV_MAX < 64 ? IOV_MAX : 64;
+            iovec iov[batch];
+            size_t next = 0, offset = written;
+            while (next < _segments.size() && offset >= _segments[next].size) offset -= _segments[next++].size;
+            while (next < _segments.size())
+            {
+                size_t count = 0;
+                for (size_t i = next; i < _segments.size() && count < batch; ++i, ++count)
                 {
-                    flush_pending_text();
-                    append_expr_seg(static_cast<const ExprNode &>(*n).expr);
-                    break;
+                    size_t skip = i == next ? offset : 0;
+                    iov[count].iov_base = const_cast<char *>(_segments[i].data + skip);
+                    iov[count].iov_len = _segments[i].size - skip;
                 }
-                case INode::Kind::code:
+                ssize_t sent = ::writev(fd, iov, static_cast<int>(count));
+                if (sent < 0)
                 {
-                    flush_pending_text();
-                    end_chain();
-                    auto *cn = static_cast<const CodeNode *>(n.get());
-                    ss << indent << cn->code << '\n';
-                    if (!cn->children.empty())
-                    {
-                        ss << indent << "{\n";
-                        acul::string new_indent = acul::string(indent) + INDENT4;
-                        write_node_list(ss, cn->children, ss_out, new_indent.c_str());
-                        ss << indent << "}\n";
-                    }
-                    break;
+                    if (errno == EINTR) continue;
+                    return false;
                 }
-                case INode::Kind::mixin_call:
-                {
-                    auto *mcn = static_cast<const MixinCall *>(n.get());
-                    auto it = _mixins_map.find(mcn->name);
-                    if (it == _mixins_map.end())
-                    {
-                        LOG_WARN("mixin [%s] was not declared", mcn->name.c_str());
-                        break;
-                    }
-                    flush_pending_text();
-                    end_chain();
-                    ss << indent << "mixins::" << mcn->name << "(ss";
+                written += static_cast<size_t>(sent);
+                size_t left = static_cast<size_t>(sent) + offset;
+                while (next < _segments.size() && left >= _segments[next].size) left -= _segments[next++].size;
+                offset = left;
+            }
+            return true;
+        }
 
-                    if (it->second->has_block)
-                    {
-                        if (mcn->children.empty())
-                            ss << ", [](acul::stringstream&) {}";
-                        else
-                        {
-                            ss << ", [&](acul::stringstream& __blk_ss) {\n";
-                            acul::string new_indent = acul::string(indent) + INDENT4;
-                            write_node_list(ss, mcn->children, "__blk_ss", new_indent.c_str());
-                            ss << indent << "}";
-                        }
-                    }
+        bool write(int fd) const
+        {
+            size_t written = 0;
+            return write(fd, written);
+        }
+#endif
 
-                    for (const auto &arg : mcn->args) ss << ", " << arg;
-                    ss << ");\n";
-                    break;
-                }
-                default:
-                    break;
+    private:
+        struct Chunk
+        {
+            std::unique_ptr<char[]> data;
+            size_t size;
+        };
+
+        acul::vector<Segment> _segments;
+        std::vector<Chunk> _chunks;
+        size_t _chunk = 0; // chunk being filled; _chunks.size() before the first copy
+        size_t _used = 0;  // bytes used in it
+        size_t _size = 0;
+
+        void next_chunk(size_t size)
+        {
+            if (_chunk < _chunks.size()) ++_chunk;
+            while (_chunk < _chunks.size() && _chunks[_chunk].size < size) ++_chunk;
+            if (_chunk == _chunks.size())
+            {
+                size_t n = size > chunk_size ? size : chunk_size;
+                _chunks.push_back({std::make_unique<char[]>(n), n});
             }
+            _used = 0;
         }
+    };
+} // namespace ahtt
+#endif
+)";
 
-        flush_pending_text();
-        end_chain();
-        return ss;
+    // Name declared by a render() parameter, skipping a default argument and array bounds.
+    static acul::string_view param_name(acul::string_view decl)
+    {
+        size_t end = 0;
+        while (end < decl.size() && decl[end] != '=') ++end;
+        int depth = 0;
+        while (end > 0)
+        {
+            char c = decl[end - 1];
+            if (c == ']')
+                ++depth;
+            else if (c == '[')
+                --depth;
+            else if (depth == 0 && !std::isspace(static_cast<unsigned char>(c)))
+                break;
+            --end;
+        }
+        size_t begin = end;
+        while (begin > 0 && (std::isalnum(static_cast<unsigned char>(decl[begin - 1])) || decl[begin - 1] == '_'))
+            --begin;
+        return decl.substr(begin, end - begin);
     }
 
     void Translator::write_to_stream(acul::stringstream &ss, const acul::string &template_name)
@@ -555,67 +905,115 @@ namespace ahtt
               "#include <acul/string/string.hpp>\n"
               "#include <acul/string/sstream.hpp>\n"
               "#include <acul/locales/locales.hpp>\n";
-        for (auto &include : _includes_map) ss << include << "\n";
-        ss << "\n";
+        for (auto &include : _includes) ss << include << "\n";
+        ss << "\n" << sink_support << "\n";
         ss << "namespace ahtt\n{\n" INDENT4 "namespace " << template_name << "\n    {\n";
 
         // External struct decl
         if (_external && _external->is_struct)
         {
             ss << INDENT8 "struct External\n" INDENT8 "{\n";
-            write_node_list(ss, _external->children, "ss", INDENT12);
-            ss << INDENT8 "};\n\n";
+            acul::string members;
+            CodeSink sink{&members, "ss", INDENT12};
+            for (auto *node : _external->children)
+                if (node->kind() == INode::Kind::code) put_statement(sink, static_cast<CodeNode *>(node)->code);
+            ss << members << INDENT8 "};\n\n";
         }
 
         // Mixins decl
-        if (!_mixins_map.empty())
+        if (!_mixins.empty())
         {
             ss << INDENT8 "namespace mixins\n" INDENT8 "{\n";
-            for (const auto &mixin : _mixins_map)
-                write_mixin_signature(ss, mixin.second.get(), mixin.second->has_block) << ";\n";
+            for (const auto &mixin : _mixins) write_mixin_signature(ss, mixin.decl, mixin.has_block) << ";\n";
             ss << '\n';
-            for (const auto &mixin : _mixins_map)
+            for (const auto &mixin : _mixins)
             {
-                auto *m = mixin.second.get();
-                write_mixin_signature(ss, m, m->has_block) << "\n" INDENT12 "{\n";
-                write_node_list(ss, m->children, "ss", INDENT16);
-                ss << INDENT12 "}\n";
+                write_mixin_signature(ss, mixin.decl, mixin.has_block) << "\n" INDENT12 "{\n";
+                ss << mixin.body << INDENT12 "}\n";
             }
             ss << INDENT8 "}\n\n";
         }
 
-        // render
-        ss << INDENT8 "inline acul::string render(";
+        // render_to, render
+        acul::string params, forward;
         if (_external)
         {
             if (_external->is_struct)
-                ss << "const External& external";
+            {
+                params = "const External& external";
+                forward = "external";
+            }
             else
             {
-                bool first = true;
                 for (const auto &node : _external->children)
                 {
                     if (node->kind() != INode::Kind::code) continue;
 
-                    if (!first) ss << ", ";
-                    first = false;
-                    auto *cn = static_cast<const CodeNode *>(node.get());
-                    ss << cn->code;
+                    if (!params.empty())
+                    {
+                        params += ", ";
+                        forward += ", ";
+                    }
+                    auto *cn = static_cast<const CodeNode *>(node);
+                    acul::string_view name = param_name(cn->code);
+                    params += cn->code;
+                    forward += "std::forward<decltype(";
+                    forward += name;
+                    forward += ")>(";
+                    forward += name;
+                    forward += ')';
                 }
             }
         }
-        ss << ")\n" INDENT8 "{\n" INDENT12 "acul::stringstream ss;\n";
-        size_t cap = 0;
-        for (const auto &node : _ast)
+
+        ss << INDENT8 "template <class Sink>\n" INDENT8 "inline void render_to(Sink& out";
+        if (!params.empty()) ss << ", " << params;
+        ss << ")\n" INDENT8 "{\n";
+        ss << INDENT12 "out.reserve(" << _body_literal_bytes << ");\n";
+        if (!_body.empty())
         {
-            if (node->kind() != INode::Kind::text) continue;
-            auto *tn = static_cast<const TextNode *>(node.get());
-            cap += tn->text.size();
+            ss << INDENT12 "auto&& ss = ahtt::sink_stream(out);\n" << _body;
+            ss << INDENT12 "ahtt::finish_stream(ss);\n";
         }
-        ss << INDENT12 "ss.reserve(" << cap << ");\n";
-        write_node_list(ss, _ast, "ss", INDENT12);
-
-        ss << INDENT12 "return ss.str();\n";
-        ss << INDENT8 "}\n" INDENT4 "}\n}";
+        ss << INDENT8 "}\n\n";
+
+        // Wrappers that render into a sink of their own and return `result` from it.
+        auto write_wrapper = [&](const char *ret, const char *name, const char *sink, const char *result) {
+            ss << INDENT8 "inline " << ret << ' ' << name << '(' << params << ")\n" INDENT8 "{\n";
+            ss << INDENT12 << sink << " out;\n";
+            ss << INDENT12 "render_to(out";
+            if (!forward.empty()) ss << ", " << forward;
+            ss << ");\n";
+            ss << INDENT12 "return " << result << ";\n";
+            ss << INDENT8 "}\n";
+        };
+        ss << INDENT8 "inline ahtt::SizeHint render_size_hint{" << _body_literal_bytes << "};\n\n";
+        ss << INDENT8 "inline acul::string render(" << params << ")\n" INDENT8 "{\n";
+        ss << INDENT12 "ahtt::PooledBuffer out;\n";
+        ss << INDENT12 "out->reserve(render_size_hint.capacity());\n";
+        ss << INDENT12 "render_to(*out";
+        if (!forward.empty()) ss << ", " << forward;
+        ss << ");\n";
+        ss << INDENT12 "render_size_hint.update(out->size());\n";
+        ss << INDENT12 "return acul::string(out->data(), out->size());\n";
+        ss << INDENT8 "}\n\n";
+        // Same as render(), but the returned string and every regrowth of it come from `resource`.
+        ss << "#ifdef AHTT_HAS_PMR\n";
+        ss << INDENT8 "inline std::pmr::string render(std::pmr::memory_resource* resource";
+        if (!params.empty()) ss << ", " << params;
+        ss << ")\n" INDENT8 "{\n";
+        ss << INDENT12 "std::pmr::string out(resource);\n";
+        ss << INDENT12 "out.reserve(render_size_hint.capacity());\n";
+        ss << INDENT12 "render_to(out";
+        if (!forward.empty()) ss << ", " << forward;
+        ss << ");\n";
+        ss << INDENT12 "render_size_hint.update(out.size());\n";
+        ss << INDENT12 "return out;\n";
+        ss << INDENT8 "}\n";
+        ss << "#endif\n\n";
+        write_wrapper("ahtt::SegmentList", "render_segments", "ahtt::SegmentList", "out");
+        ss << '\n';
+        write_wrapper("size_t", "measure", "ahtt::SizeCounter", "out.size()");
+        ss << INDENT4 "}\n}";
     }
-} // namespace ahtt
\ No newline at end of file
+} // namespace ahtt
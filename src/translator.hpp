@@ -4,54 +4,86 @@
 #include <acul/string/sstream.hpp>
 #include "parser.hpp"
 
-#define AHTT_PARSE_DEFAULT     0x0
-#define AHTT_PARSE_BLOCK_ADDED 0x1
-
 namespace ahtt
 {
+    // Generated statements of one function body. Literal bytes collect in `literal` and are written as a
+    // single string segment once an expression, a statement or the end of the body interrupts them.
+    struct CodeSink
+    {
+        acul::string *out;
+        const char *ss_out;
+        acul::string indent;
+        acul::string literal;
+        bool chain_open = false;
+        bool chain_empty = false;
+        // Literal bytes written at this level, used to size the stream of render().
+        size_t literal_bytes = 0;
+        // Fragments, statements and calls written at this level; zero leaves a nested body out entirely.
+        size_t emitted = 0;
+
+        CodeSink(acul::string *out, const char *ss_out, acul::string indent)
+            : out(out), ss_out(ss_out), indent(std::move(indent))
+        {
+        }
+    };
+
     class Translator
     {
     public:
         Translator(Parser &parser) : _p(parser) {}
 
-        void parse_tokens()
-        {
-            NodeList ast;
-            parse_tokens(_p.ast, ast);
-            _ast = std::move(ast);
-        }
+        // Walks the parsed tree once and generates the bodies of render() and of every mixin.
+        void parse_tokens();
 
         void write_to_stream(acul::stringstream &ss, const acul::string &template_name);
 
     private:
+        struct Mixin
+        {
+            const MixinDecl *decl;
+            bool has_block;
+            bool translated = false;
+            acul::string body;
+        };
+
         Parser &_p;
+        // Owns the external declarations; everything else is generated as text.
+        NodeArena _arena;
+        // Both kept in first-declaration order so the generated header is byte-stable.
+        acul::vector<acul::string> _includes;
         acul::hashset<acul::string> _includes_map;
-        acul::hashmap<acul::string, acul::unique_ptr<MixinDecl>> _mixins_map;
-        acul::unique_ptr<ExternalNode> _external;
+        acul::vector<Mixin> _mixins;
+        acul::hashmap<acul::string, size_t> _mixins_map;
+        ExternalNode *_external = nullptr;
         HTMLNode *_doctype = nullptr;
-        NodeList _ast;
+        acul::string _body;
+        size_t _body_literal_bytes = 0;
+        CodeSink *_sink = nullptr;
+        // Receives the output of subtrees that are walked only for their includes and declarations.
+        acul::string _discard;
+        acul::string _text;
+        StructuralIndex _scan;
 
-        int build_html(NodeList &ast, HTMLNode *node);
+        void collect_mixins(const NodeList &nodes);
+        void build_html(HTMLNode *node);
         void build_external_node(ExternalNode *current);
-        int parse_node(INode *node, NodeList &ast);
+        void translate_node(INode *node);
+        void translate_code(CodeNode *node);
+        void translate_mixin_decl(MixinDecl *decl);
+        void translate_mixin_call(MixinCall *call);
+        void translate_text(acul::string_view raw);
 
-        inline int parse_tokens(NodeList &elements, NodeList &ast)
+        inline void translate(const NodeList &nodes)
         {
-            int flags = AHTT_PARSE_DEFAULT;
-            for (auto &node : elements) flags |= parse_node(node.get(), ast);
-            return flags;
+            for (auto *node : nodes) translate_node(node);
         }
 
-        inline void parse_mixin(MixinDecl *origin, MixinDecl *m)
+        // Translates `nodes` into `sink` instead of the current body.
+        void translate_into(CodeSink &sink, const NodeList &nodes);
+
+        inline void add_include(acul::string &&include)
         {
-            m->name = origin->name;
-            m->args = std::move(origin->args);
-            m->pos = origin->pos;
-            int flags = parse_tokens(origin->children, m->children);
-            m->has_block = flags & AHTT_PARSE_BLOCK_ADDED;
+            if (_includes_map.emplace(include).second) _includes.push_back(std::move(include));
         }
-
-        acul::stringstream &write_node_list(acul::stringstream &ss, const NodeList &nodes, const char *ss_out,
-                                            const char *indent);
     };
-} // namespace ahtt
\ No newline at end of file
+} // namespace ahtt
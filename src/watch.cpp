@@ -0,0 +1,160 @@
+#include "watch.hpp"
+#include <acul/hash/hashset.hpp>
+#include <acul/log.hpp>
+#include <algorithm>
+#include <filesystem>
+
+#ifdef __linux__
+    #include <csignal>
+    #include <poll.h>
+    #include <sys/inotify.h>
+    #include <unistd.h>
+#endif
+
+#define AHTT_WATCH_DEBOUNCE_MS 30
+
+namespace ahtt
+{
+#ifdef __linux__
+    static volatile sig_atomic_t g_watch_stop = 0;
+
+    static void on_watch_signal(int) { g_watch_stop = 1; }
+
+    static acul::string normalize(const acul::string &path)
+    {
+        std::error_code ec;
+        auto canonical = std::filesystem::weakly_canonical(std::filesystem::path(path.c_str()), ec);
+        return ec ? path : acul::string(canonical.string().c_str());
+    }
+
+    // Reverse dependency index: file -> templates built from it.
+    class DependencyGraph
+    {
+    public:
+        explicit DependencyGraph(int inotify_fd, size_t jobs) : _fd(inotify_fd), _deps(jobs) {}
+
+        void set(size_t job, const Job &j, const IOInfo &io)
+        {
+            for (const auto &file : _deps[job])
+            {
+                auto it = _dependents.find(file);
+                if (it != _dependents.end()) it->second.erase(job);
+            }
+
+            // Keep watching the input even if it failed to load, so fixing it triggers a rebuild.
+            acul::vector<acul::string> files{normalize(j.input.str())};
+            for (const auto &info : io) files.push_back(normalize(info.path.str()));
+            std::sort(files.begin(), files.end());
+            files.erase(std::unique(files.begin(), files.end()), files.end());
+
+            for (const auto &file : files)
+            {
+                _dependents[file].insert(job);
+                add_watch(acul::string(std::filesystem::path(file.c_str()).parent_path().string().c_str()));
+            }
+            _deps[job] = std::move(files);
+        }
+
+        // Collects the templates affected by pending inotify events.
+        void drain(acul::hashset<size_t> &dirty)
+        {
+            alignas(inotify_event) char buf[16384];
+            while (true)
+            {
+                ssize_t n = ::read(_fd, buf, sizeof(buf));
+                if (n <= 0) return;
+                for (char *p = buf; p < buf + n;)
+                {
+                    auto *ev = reinterpret_cast<inotify_event *>(p);
+                    p += sizeof(inotify_event) + ev->len;
+
+                    auto dir = _dirs.find(ev->wd);
+                    if (dir == _dirs.end()) continue;
+                    if (ev->mask & IN_IGNORED)
+                    {
+                        _watched.erase(dir->second);
+                        _dirs.erase(dir);
+                        continue;
+                    }
+                    if (ev->len == 0) continue;
+
+                    acul::string file = dir->second + "/" + ev->name;
+                    auto it = _dependents.find(file);
+                    if (it == _dependents.end()) continue;
+                    LOG_INFO("Changed: %s", file.c_str());
+                    for (size_t job : it->second) dirty.insert(job);
+                }
+            }
+        }
+
+    private:
+        int _fd;
+        acul::vector<acul::vector<acul::string>> _deps;
+        acul::hashmap<acul::string, acul::hashset<size_t>> _dependents;
+        acul::hashmap<int, acul::string> _dirs;
+        acul::hashset<acul::string> _watched;
+
+        void add_watch(const acul::string &dir)
+        {
+            if (_watched.find(dir) != _watched.end()) return;
+            int wd = inotify_add_watch(_fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE);
+            if (wd < 0)
+            {
+                LOG_WARN("Failed to watch %s", dir.c_str());
+                return;
+            }
+            _watched.insert(dir);
+            _dirs[wd] = dir;
+        }
+    };
+
+    void watch(const acul::vector<Job> &jobs, const Session &session, size_t threads)
+    {
+        int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (fd < 0) throw acul::runtime_error("Failed to initialize inotify");
+
+        DependencyGraph graph(fd, jobs.size());
+        acul::vector<IOInfo> deps;
+        run_batch(jobs, session, threads, &deps);
+        for (size_t i = 0; i < jobs.size(); ++i) graph.set(i, jobs[i], deps[i]);
+
+        g_watch_stop = 0;
+        std::signal(SIGINT, on_watch_signal);
+        std::signal(SIGTERM, on_watch_signal);
+        LOG_INFO("Watching %zu templates", jobs.size());
+
+        while (!g_watch_stop)
+        {
+            pollfd pfd{fd, POLLIN, 0};
+            if (::poll(&pfd, 1, 250) <= 0) continue;
+
+            // Editors tend to emit several events per save; collect them into one rebuild.
+            acul::hashset<size_t> dirty;
+            do
+            {
+                graph.drain(dirty);
+            } while (::poll(&pfd, 1, AHTT_WATCH_DEBOUNCE_MS) > 0);
+            if (dirty.empty()) continue;
+
+            acul::vector<size_t> indices;
+            indices.reserve(dirty.size());
+            for (size_t i : dirty) indices.push_back(i);
+            std::sort(indices.begin(), indices.end());
+            acul::vector<Job> rebuild;
+            rebuild.reserve(indices.size());
+            for (size_t i : indices) rebuild.push_back(jobs[i]);
+
+            run_batch(rebuild, session, threads, &deps);
+            for (size_t k = 0; k < indices.size(); ++k) graph.set(indices[k], jobs[indices[k]], deps[k]);
+        }
+
+        ::close(fd);
+        LOG_INFO("Watch stopped");
+    }
+#else
+    void watch(const acul::vector<Job> &, const Session &, size_t)
+    {
+        throw acul::runtime_error("Watch mode is only supported on Linux");
+    }
+#endif
+} // namespace ahtt
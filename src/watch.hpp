@@ -0,0 +1,10 @@
+#pragma once
+
+#include "driver.hpp"
+
+namespace ahtt
+{
+    // Transpiles every job, then watches the files they were built from and re-transpiles only the
+    // templates whose dependencies changed. Runs until SIGINT/SIGTERM. Linux only (inotify).
+    void watch(const acul::vector<Job> &jobs, const Session &session, size_t threads);
+} // namespace ahtt
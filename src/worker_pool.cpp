@@ -0,0 +1,61 @@
+#include "worker_pool.hpp"
+
+namespace ahtt
+{
+    WorkerPool::WorkerPool(size_t threads) : _max_threads(threads ? threads : 1) { _threads.reserve(_max_threads); }
+
+    WorkerPool::~WorkerPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stop = true;
+        }
+        _cv_task.notify_all();
+        for (auto &t : _threads) t.join();
+    }
+
+    void WorkerPool::submit(std::function<void()> task) { push(_queue, std::move(task)); }
+
+    void WorkerPool::submit_priority(std::function<void()> task) { push(_priority, std::move(task)); }
+
+    void WorkerPool::push(std::deque<std::function<void()>> &queue, std::function<void()> task)
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            queue.push_back(std::move(task));
+            // Workers start as tasks arrive, so a pool that gets no work costs no threads.
+            if (_queue.size() + _priority.size() > _threads.size() - _active && _threads.size() < _max_threads)
+                _threads.emplace_back([this] { worker_loop(); });
+        }
+        _cv_task.notify_one();
+    }
+
+    void WorkerPool::wait()
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _cv_idle.wait(lock, [this] { return _queue.empty() && _priority.empty() && _active == 0; });
+    }
+
+    void WorkerPool::worker_loop()
+    {
+        while (true)
+        {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _cv_task.wait(lock, [this] { return _stop || !_queue.empty() || !_priority.empty(); });
+                auto &queue = _priority.empty() ? _queue : _priority;
+                if (queue.empty()) return;
+                task = std::move(queue.front());
+                queue.pop_front();
+                ++_active;
+            }
+            task();
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                --_active;
+                if (_queue.empty() && _priority.empty() && _active == 0) _cv_idle.notify_all();
+            }
+        }
+    }
+} // namespace ahtt
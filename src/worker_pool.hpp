@@ -0,0 +1,52 @@
+#pragma once
+
+#include <acul/vector.hpp>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace ahtt
+{
+    class WorkerPool
+    {
+    public:
+        // Starts up to `threads` workers, each only once the queued tasks outnumber the idle ones.
+        explicit WorkerPool(size_t threads);
+        ~WorkerPool();
+
+        WorkerPool(const WorkerPool &) = delete;
+        WorkerPool &operator=(const WorkerPool &) = delete;
+
+        void submit(std::function<void()> task);
+
+        // Queues `task` ahead of every task from submit(), for work a running task will soon wait on.
+        void submit_priority(std::function<void()> task);
+
+        // Blocks until the queue is drained and every worker is idle.
+        void wait();
+
+        size_t size() const { return _max_threads; }
+
+        static size_t default_size()
+        {
+            unsigned n = std::thread::hardware_concurrency();
+            return n ? n : 1;
+        }
+
+    private:
+        size_t _max_threads;
+        acul::vector<std::thread> _threads;
+        std::deque<std::function<void()>> _queue;
+        std::deque<std::function<void()>> _priority; // drained before _queue
+        std::mutex _mutex;
+        std::condition_variable _cv_task;
+        std::condition_variable _cv_idle;
+        size_t _active = 0;
+        bool _stop = false;
+
+        void push(std::deque<std::function<void()>> &queue, std::function<void()> task);
+        void worker_loop();
+    };
+} // namespace ahtt